@@ -1,4 +1,5 @@
 #if !defined(_WIN32)
+#include <cinttypes>
 #include <fcntl.h>
 #include <pthread.h>
 #include <string>
@@ -26,12 +27,17 @@ void emit_statistics(state_exporter::_export_structure_ *const counts, const std
 	printf("Search nodes: %u, qs nodes: %u, ratio: %.3f\n", counts->counters.nodes, counts->counters.qnodes, double(counts->counters.qnodes)/counts->counters.nodes);
 	printf("draws: %.2f%% (%u), standing pat: %.2f%% (%u)\n", counts->counters.n_draws * 100. / counts->counters.nodes, counts->counters.n_draws, counts->counters.n_standing_pat * 100. / counts->counters.qnodes, counts->counters.n_standing_pat);
 	printf("%u tt query, %u ttstore, %.2f%% hit, query/store factor: %.2f, invalid: %.2f%% (%u), cut-off: %.2f%% (%u)\n", counts->counters.tt_query, counts->counters.tt_store, counts->counters.tt_hit * 100. / counts->counters.tt_query, counts->counters.tt_query / double(counts->counters.tt_store), counts->counters.tt_invalid * 100. / counts->counters.tt_query, counts->counters.tt_invalid, counts->counters.tt_cutoff * 100. / counts->counters.tt_query, counts->counters.tt_cutoff);
+	printf("tt torn/racing entries rejected: %u\n", counts->counters.tt_rejected);
+	printf("static evaluations from tt: %u\n", counts->counters.tt_eval_hit);
 	printf("%u qtt query, %u qttstore, %.2f%% hit, query/store factor: %.2f, cut-off: %.2f%% (%u)\n", counts->counters.qtt_query, counts->counters.qtt_store, counts->counters.qtt_hit * 100. / counts->counters.qtt_query, counts->counters.qtt_query / double(counts->counters.qtt_store), counts->counters.qtt_cutoff * 100. / counts->counters.qtt_query, counts->counters.qtt_cutoff);
 	printf("Syzygy queries: %u, hits: %.2f%%\n", counts->counters.syzygy_queries, counts->counters.syzygy_query_hits * 100. / counts->counters.syzygy_queries);
 	printf("Average beta-cutoff index: %.2f, QS beta-cutoff index: %.2f\n", counts->counters.n_moves_cutoff / double(counts->counters.nmc_nodes), counts->counters.n_qmoves_cutoff / double(counts->counters.nmc_qnodes));
 	printf("Null move cutoff: %.2f%% (%u out of %u)\n", counts->counters.n_null_move_hit * 100. / counts->counters.n_null_move, counts->counters.n_null_move_hit, counts->counters.n_null_move);
 	printf("late-move-reduction cutoff: %.2f%% (%u out of %u)\n", counts->counters.n_lmr_hit * 100.0 / counts->counters.n_lmr, counts->counters.n_lmr_hit, counts->counters.n_lmr);
 	printf("static evaluation cutoff: %.2f%% (%u out of %u)\n", counts->counters.n_static_eval_hit * 100. / counts->counters.n_static_eval, counts->counters.n_static_eval_hit, counts->counters.n_static_eval);
+	printf("nnue accumulator updates skipped: %.2f%% (%" PRIu64 " out of %" PRIu64 ")\n", counts->counters.nnue_updates_skipped * 100. / counts->counters.nnue_updates, counts->counters.nnue_updates_skipped, counts->counters.nnue_updates);
+	printf("eval cache: %.2f%% hit (%" PRIu64 " out of %" PRIu64 "), saved about %.3f s\n", counts->counters.eval_cache_hit * 100. / counts->counters.eval_cache_query, counts->counters.eval_cache_hit, counts->counters.eval_cache_query, counts->counters.eval_cache_hit * (counts->counters.eval_timed_ns / double(counts->counters.eval_timed)) / 1e9);
+	printf("quiet move generation skipped: %.2f%% (%" PRIu64 " out of %" PRIu64 ")\n", counts->counters.quiet_gen_skipped * 100. / counts->counters.quiet_gen, counts->counters.quiet_gen_skipped, counts->counters.quiet_gen);
 	printf("average alpha/beta aspiration window distance: %.2f/%.2f\n", counts->counters.alpha_distance / double(counts->counters.n_alpha_distances), counts->counters.beta_distance / double(counts->counters.n_beta_distances));
 
 	printf("UNLOCK %d\n", pthread_mutex_unlock(&counts->mutex));
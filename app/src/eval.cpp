@@ -1,7 +1,13 @@
+#include <array>
 #include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 #include <libchess/Position.h>
 #include "eval.h"
 #include "nnue.h"
+#include "tt.h"
 
 
 using namespace libchess;
@@ -21,33 +27,170 @@ void init_move(Eval *const e, const libchess::Position & pos)
 	e->set(pos);
 }
 
-void remove_piece(Eval *const e, const Square & loc, const PieceType & pt, const bool is_white, std::array<undo_t, 4> *const undos, int *const n_undos)
+// these only record the change, it is applied to the accumulators after
+// the move was made on the board (see make_move)
+struct move_changes
 {
-	e->remove_piece(pt, loc, is_white);
-	undos->at((*n_undos)++) = { loc, pt, is_white, true };
+	piece_change added  [2];
+	piece_change removed[2];
+	int          n_added   { 0 };
+	int          n_removed { 0 };
+};
+
+static void remove_piece(const Square & loc, const PieceType & pt, const bool is_white, move_changes *const changes)
+{
+	assert(changes->n_removed < 2);
+	changes->removed[changes->n_removed++] = { pt, loc, is_white };
+}
+
+static void add_piece(const Square & loc, const PieceType & pt, const bool is_white, move_changes *const changes)
+{
+	assert(changes->n_added < 2);
+	changes->added[changes->n_added++] = { pt, loc, is_white };
+}
+
+static void move_piece(const Square & from, const Square & to, const PieceType & pt, const bool is_white, move_changes *const changes)
+{
+	remove_piece(from, pt, is_white, changes);
+	add_piece   (to,   pt, is_white, changes);
+}
+
+#if !defined(ESP32)
+// The Zobrist keys, taken from libchess itself: the difference between the
+// hashes of two positions that only differ in that piece (or in the side to
+// move). For the kings (which can't be left out) it is relative to the king
+// on a reference square, which cancels out as a king move XORs two of them.
+struct zobrist_keys
+{
+	uint64_t pieces[2][6][64];  // [white/black][piece type][square]
+	uint64_t side;
+};
+
+// board[0] is a1, board[63] is h8
+static uint64_t hash_of(const std::array<char, 64> & board, const bool white_to_move)
+{
+	std::string fen;
+	for(int rank=7; rank>=0; rank--) {
+		int n_empty = 0;
+		for(int file=0; file<8; file++) {
+			char c = board[rank * 8 + file];
+			if (c == ' ') {
+				n_empty++;
+				continue;
+			}
+			if (n_empty)
+				fen += char('0' + n_empty);
+			n_empty = 0;
+			fen += c;
+		}
+		if (n_empty)
+			fen += char('0' + n_empty);
+		if (rank)
+			fen += '/';
+	}
+	fen += white_to_move ? " w - - 0 1" : " b - - 0 1";
+
+	return Position(fen).hash();
+}
+
+static const zobrist_keys & get_zobrist_keys()
+{
+	static const zobrist_keys keys = [] {
+		zobrist_keys k { };
+		const char *const names = "pnbrqk";
+
+		std::array<char, 64> board;
+		for(int sq=0; sq<64; sq++) {
+			// the kings out of the way of the piece
+			board.fill(' ');
+			board[sq == 0 || sq == 63 ? 7 : 0 ] = 'K';
+			board[sq == 0 || sq == 63 ? 56 : 63] = 'k';
+			uint64_t without = hash_of(board, true);
+			for(int color=0; color<2; color++) {
+				for(int pt=0; pt<5; pt++) {
+					auto with = board;
+					with[sq]  = color == 0 ? toupper(names[pt]) : names[pt];
+					k.pieces[color][pt][sq] = hash_of(with, true) ^ without;
+				}
+			}
+
+			// white king: relative to a1, black king: relative to h8
+			for(int color=0; color<2; color++) {
+				const char king = color == 0 ? 'K' : 'k';
+				board.fill(' ');
+				if (color == 0)
+					board[sq == 63 ? 62 : 63] = 'k';
+				else
+					board[sq == 0 ? 1 : 0] = 'K';
+				auto at_sq  = board;
+				auto at_ref = board;
+				at_sq [sq]                   = king;
+				at_ref[color == 0 ? 0 : 63] = king;
+				k.pieces[color][constants::KING][sq] = hash_of(at_sq, true) ^ hash_of(at_ref, true);
+			}
+		}
+
+		board.fill(' ');
+		board[0]  = 'K';
+		board[63] = 'k';
+		k.side = hash_of(board, true) ^ hash_of(board, false);
+
+		return k;
+	}();
+
+	return keys;
 }
+#endif
 
-void add_piece(Eval *const e, const Square & loc, const PieceType & pt, const bool is_white, std::array<undo_t, 4> *const undos, int *const n_undos)
+std::optional<uint64_t> predict_hash(const Position & pos, const Move & move)
 {
-	e->add_piece(pt, loc, is_white);
-	undos->at((*n_undos)++) = { loc, pt, is_white, false };
+#if defined(ESP32)
+	return { };  // no cache that a prefetch would help
+#else
+	// the squares of the kings and rooks that castling rights depend on
+	constexpr uint64_t castling_squares = (1ull << 0) | (1ull << 4) | (1ull << 7) | (1ull << 56) | (1ull << 60) | (1ull << 63);
+
+	Square from_square = move.from_square();
+	Square to_square   = move.to_square  ();
+
+	if (pos.enpassant_square().has_value() || move.type() == Move::Type::DOUBLE_PUSH ||
+	    move.type() == Move::Type::ENPASSANT || move.type() == Move::Type::CASTLING ||
+	    (((1ull << int(from_square)) | (1ull << int(to_square))) & castling_squares))
+		return { };
+
+	const zobrist_keys & keys = get_zobrist_keys();
+
+	int  color        = pos.side_to_move() == constants::WHITE ? 0 : 1;
+	auto moving_pt    = pos.piece_type_on(from_square);
+	auto captured_pt  = pos.piece_type_on(to_square  );
+	auto promotion_pt = move.promotion_piece_type();
+
+	uint64_t hash = pos.hash() ^ keys.side;
+	hash ^= keys.pieces[color][int(*moving_pt)][int(from_square)];
+	if (captured_pt.has_value())
+		hash ^= keys.pieces[color ^ 1][int(*captured_pt)][int(to_square)];
+	hash ^= keys.pieces[color][int(promotion_pt.has_value() ? *promotion_pt : *moving_pt)][int(to_square)];
+
+	return hash;
+#endif
 }
 
-void move_piece(Eval *const e, const Square & from, const Square & to, const PieceType & pt, const bool is_white, std::array<undo_t, 4> *const undos, int *const n_undos)
+static void prefetch(const uint64_t hash, const eval_cache *const ec)
 {
-	remove_piece(e, from, pt, is_white, undos, n_undos);
-	add_piece   (e, to,   pt, is_white, undos, n_undos);
+	tti.prefetch(hash);
+	if (ec)
+		ec->prefetch(hash);
 }
 
-std::pair<int, std::array<undo_t, 4> > make_move(Eval *const e, Position & pos, const Move & move)
+void make_move(Eval *const e, Position & pos, const Move & move, const eval_cache *const ec)
 {
-	int                   n_actions = 0;
-	std::array<undo_t, 4> actions { {
-		{ libchess::constants::A1, libchess::constants::PAWN, false, false },
-		{ libchess::constants::A1, libchess::constants::PAWN, false, false },
-		{ libchess::constants::A1, libchess::constants::PAWN, false, false },
-		{ libchess::constants::A1, libchess::constants::PAWN, false, false }
-	} };
+	// the probes of search()/qs() follow right after this: start fetching
+	// their cache lines before the board and the NNUE bookkeeping is done
+	auto child_hash = predict_hash(pos, move);
+	if (child_hash.has_value())
+		prefetch(child_hash.value(), ec);
+
+	move_changes changes;
 
 	Square from_square = move.from_square();
 	Square to_square   = move.to_square  ();
@@ -65,50 +208,50 @@ std::pair<int, std::array<undo_t, 4> > make_move(Eval *const e, Position & pos,
 		case Move::Type::NORMAL:
 		case Move::Type::DOUBLE_PUSH:
 			assert(moving_pt.has_value());
-			move_piece(e, from_square, to_square, *moving_pt, is_white, &actions, &n_actions);
+			move_piece(from_square, to_square, *moving_pt, is_white, &changes);
 			assert(*moving_pt == constants::PAWN || move.type() != Move::Type::DOUBLE_PUSH);
 			break;
 		case Move::Type::CAPTURE:
 			assert(captured_pt.has_value());
 			assert(pos.color_of(from_square) != pos.color_of(to_square));
-			remove_piece(e, to_square, *captured_pt, !is_white, &actions, &n_actions);
-			move_piece(e, from_square, to_square, *moving_pt, is_white, &actions, &n_actions);
+			remove_piece(to_square, *captured_pt, !is_white, &changes);
+			move_piece(from_square, to_square, *moving_pt, is_white, &changes);
 			break;
 		case Move::Type::ENPASSANT:
 			assert(*moving_pt == constants::PAWN);
 			assert(pos.color_of(from_square) != pos.color_of(is_white ? Square(to_square - 8) : Square(to_square + 8)));
-			move_piece(e, from_square, to_square, constants::PAWN, is_white, &actions, &n_actions);
+			move_piece(from_square, to_square, constants::PAWN, is_white, &changes);
 			assert(pos.piece_type_on(is_white ? Square(to_square - 8) : Square(to_square + 8)) == constants::PAWN);
-			remove_piece(e, is_white ? Square(to_square - 8) : Square(to_square + 8), constants::PAWN, !is_white, &actions, &n_actions);
+			remove_piece(is_white ? Square(to_square - 8) : Square(to_square + 8), constants::PAWN, !is_white, &changes);
 			break;
 		case Move::Type::CASTLING:
 			assert(*moving_pt == constants::KING);
 			assert(pos.color_of(from_square) == (is_white ? constants::WHITE : constants::BLACK));
-			move_piece(e, from_square, to_square, constants::KING, is_white, &actions, &n_actions);
+			move_piece(from_square, to_square, constants::KING, is_white, &changes);
 			switch (to_square) {
 				case constants::C1:
 					assert(is_white);
 					assert(pos.color_of(constants::A1) == constants::WHITE);
 					assert(pos.piece_type_on(constants::D1).has_value() == false);
-					move_piece(e, constants::A1, constants::D1, constants::ROOK, true, &actions, &n_actions);
+					move_piece(constants::A1, constants::D1, constants::ROOK, true, &changes);
 					break;
 				case constants::G1:
 					assert(is_white);
 					assert(pos.color_of(constants::H1) == constants::WHITE);
 					assert(pos.piece_type_on(constants::F1).has_value() == false);
-					move_piece(e, constants::H1, constants::F1, constants::ROOK, true, &actions, &n_actions);
+					move_piece(constants::H1, constants::F1, constants::ROOK, true, &changes);
 					break;
 				case constants::C8:
 					assert(!is_white);
 					assert(pos.color_of(constants::A8) == constants::BLACK);
 					assert(pos.piece_type_on(constants::D8).has_value() == false);
-					move_piece(e, constants::A8, constants::D8, constants::ROOK, false, &actions, &n_actions);
+					move_piece(constants::A8, constants::D8, constants::ROOK, false, &changes);
 					break;
 				case constants::G8:
 					assert(!is_white);
 					assert(pos.color_of(constants::H8) == constants::BLACK);
 					assert(pos.piece_type_on(constants::F8).has_value() == false);
-					move_piece(e, constants::H8, constants::F8, constants::ROOK, false, &actions, &n_actions);
+					move_piece(constants::H8, constants::F8, constants::ROOK, false, &changes);
 					break;
 				default:
 					assert(false);
@@ -120,17 +263,17 @@ std::pair<int, std::array<undo_t, 4> > make_move(Eval *const e, Position & pos,
 			assert(*promotion_pt != constants::PAWN);
 			assert((pos.color_of(from_square) == constants::WHITE && to_square.rank() == 7) ||
 			       (pos.color_of(from_square) == constants::BLACK && to_square.rank() == 0));
-			remove_piece(e, from_square, constants::PAWN, is_white, &actions, &n_actions);
-			add_piece   (e, to_square,  *promotion_pt,    is_white, &actions, &n_actions);
+			remove_piece(from_square, constants::PAWN, is_white, &changes);
+			add_piece   (to_square,  *promotion_pt,    is_white, &changes);
 			break;
 		case Move::Type::CAPTURE_PROMOTION:
 			assert(*moving_pt == constants::PAWN);
 			assert(*promotion_pt != constants::PAWN);
 			assert((pos.color_of(from_square) == constants::WHITE && to_square.rank() == 7) ||
 			       (pos.color_of(from_square) == constants::BLACK && to_square.rank() == 0));
-			remove_piece(e, to_square,  *captured_pt,    !is_white, &actions, &n_actions);
-			remove_piece(e, from_square, constants::PAWN, is_white, &actions, &n_actions);
-			add_piece   (e, to_square,  *promotion_pt,    is_white, &actions, &n_actions);
+			remove_piece(to_square,  *captured_pt,    !is_white, &changes);
+			remove_piece(from_square, constants::PAWN, is_white, &changes);
+			add_piece   (to_square,  *promotion_pt,    is_white, &changes);
 			break;
 		default:
 			printf("type is %d\n", int(move.type()));
@@ -140,6 +283,13 @@ std::pair<int, std::array<undo_t, 4> > make_move(Eval *const e, Position & pos,
 
 	pos.make_move(move);
 
+	assert(child_hash.has_value() == false || child_hash.value() == pos.hash());
+	if (child_hash.has_value() == false)
+		prefetch(pos.hash(), ec);
+
+	// a king move can also move it to another bucket, the side that moved then gets its accumulator from pos
+	e->push(changes.added, changes.n_added, changes.removed, changes.n_removed, pos);
+
 #if !defined(NDEBUG)
 	if (pos.enpassant_square().has_value()) {
 		auto file = pos.enpassant_square().value().file();
@@ -153,19 +303,50 @@ std::pair<int, std::array<undo_t, 4> > make_move(Eval *const e, Position & pos,
 		}
 	}
 #endif
+}
 
-	return { n_actions, actions };
+// returns false when the accumulators of the position that is left were never needed
+bool unmake_move(Eval *const e, Position & pos)
+{
+	pos.unmake_move();
+	return e->pop();
 }
 
-void unmake_move(Eval *const e, Position & pos, const std::pair<int, std::array<undo_t, 4> > & actions)
+eval_cache::eval_cache(const size_t size)
 {
-	for(int i=0; i<actions.first; i++) {
-		auto & action = actions.second[i];
-		if (action.is_put)
-			e->add_piece(action.type, action.location, action.is_white);
-		else
-			e->remove_piece(action.type, action.location, action.is_white);
-	}
+	size_t n = 1;  // largest power of 2 that fits
+	while(n * 2 * sizeof(uint64_t) <= size)
+		n *= 2;
+	mask    = n - 1;
+	entries = reinterpret_cast<uint64_t *>(malloc(n * sizeof(uint64_t)));
+	reset();
+}
 
-	pos.unmake_move();
+eval_cache::~eval_cache()
+{
+	free(entries);
+}
+
+void eval_cache::reset()
+{
+	memset(entries, 0x00, (mask + 1) * sizeof(uint64_t));
+}
+
+void eval_cache::prefetch(const uint64_t hash) const
+{
+	__builtin_prefetch(&entries[hash & mask]);
+}
+
+std::optional<int> eval_cache::lookup(const uint64_t hash) const
+{
+	uint64_t e = entries[hash & mask];
+	if ((e ^ hash) >> 16)
+		return { };
+
+	return int16_t(e & 0xffff);
+}
+
+void eval_cache::store(const uint64_t hash, const int score)
+{
+	entries[hash & mask] = (hash & ~uint64_t(0xffff)) | uint16_t(score);
 }
@@ -1,16 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+
 #include "nnue.h"
 
 int nnue_evaluate(const Eval *const e, const libchess::Position & pos);
 int nnue_evaluate(const Eval *const e, const libchess::Color & c);
 
-struct undo_t
+class eval_cache;
+
+void init_move  (Eval *const e, const libchess::Position & pos);
+// also prefetches what the probes of the new position need: the TT cluster and, when given, the eval cache line
+void make_move  (Eval *const e, libchess::Position & pos, const libchess::Move & move, const eval_cache *const ec = nullptr);
+bool unmake_move(Eval *const e, libchess::Position & pos);
+
+// the hash of the position after 'move', before it is made; not for the
+// moves that involve castling rights or an en passant square
+std::optional<uint64_t> predict_hash(const libchess::Position & pos, const libchess::Move & move);
+
+// per-thread hash -> static evaluation, direct-mapped; an entry is the upper
+// 48 bits of the hash with the score in the lower 16
+class eval_cache
 {
-	libchess::Square    location;
-	libchess::PieceType type;
-	bool                is_white;
-	bool                is_put;  // else remove
+private:
+	uint64_t *entries { nullptr };
+	uint64_t  mask    { 0       };
+
+public:
+	eval_cache(const size_t size);
+	~eval_cache();
+
+	void reset();
+
+	void prefetch(const uint64_t hash) const;
+	std::optional<int> lookup(const uint64_t hash) const;
+	void store(const uint64_t hash, const int score);
 };
 
-void init_move  (Eval *const e, const libchess::Position & pos);
-void unmake_move(Eval *const e, libchess::Position & pos, const std::pair<int, std::array<undo_t, 4> > & actions);
-std::pair<int, std::array<undo_t, 4> > make_move(Eval *const e, libchess::Position & pos, const libchess::Move & move);
+#if defined(ESP32)
+constexpr size_t eval_cache_default_size = 8 * 1024;  // in bytes
+#else
+constexpr size_t eval_cache_default_size = 128 * 1024;
+#endif
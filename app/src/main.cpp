@@ -4,6 +4,7 @@
 // above it for details.
 #include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <chrono>
 #include <cinttypes>
 #include <condition_variable>
@@ -86,6 +87,60 @@ std::vector<search_pars_t *> sp;
 state_exporter              *se { nullptr };
 #endif
 
+#if defined(ALLOC_COUNT)
+#if !defined(__GLIBC__)
+#error ALLOC_COUNT requires glibc
+#endif
+// glibc: interpose the allocator entry points (operator new ends up here too)
+extern "C" {
+void *__libc_malloc  (size_t size);
+void *__libc_calloc  (size_t n, size_t size);
+void *__libc_realloc (void *p, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+thread_local bool    alloc_counting = false;
+std::atomic_uint64_t alloc_count { 0 };
+
+extern "C" {
+void *malloc(size_t size)
+{
+	if (alloc_counting)
+		alloc_count++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	if (alloc_counting)
+		alloc_count++;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	if (alloc_counting)
+		alloc_count++;
+	return __libc_realloc(p, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	if (alloc_counting)
+		alloc_count++;
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size)
+{
+	if (alloc_counting)
+		alloc_count++;
+	*p = __libc_memalign(alignment, size);
+	return *p ? 0 : ENOMEM;
+}
+}
+#endif
+
 polyglot_book pb;
 
 constexpr const char *const uart_settings_file = "/spiffs/uart.dat";
@@ -463,6 +518,10 @@ void delete_threads()
 		i->thread_handle->join();
 		delete i->thread_handle;
 		delete i->nnue_eval;
+		delete i->qtt;
+		delete i->ecache;
+		delete [] i->ss;
+		delete [] i->pv_table;
 		delete i->stop;
 		free(i->history);
 		delete i;
@@ -474,6 +533,8 @@ void delete_threads()
 	work.reconfigure_threads = false;
 }
 
+bool use_qs_cache = false;
+
 void allocate_threads(const int n)
 {
 	delete_threads();
@@ -481,7 +542,14 @@ void allocate_threads(const int n)
 	for(int i=0; i<n; i++) {
 		sp.push_back(new search_pars_t({ reinterpret_cast<int16_t *>(calloc(1, history_malloc_size)), new end_t, i }));
 		sp.at(i)->thread_handle = new std::thread(searcher, i);
-		sp.at(i)->nnue_eval     = new Eval(sp.at(i)->pos);
+		sp.at(i)->nnue_eval     = Eval::create(sp.at(i)->pos);
+		sp.at(i)->ecache        = new eval_cache(eval_cache_default_size);
+		sp.at(i)->ss            = new search_stack_t[max_ply];
+		sp.at(i)->pv_table      = new libchess::Move[pv_table_size];
+		for(int p=0, offset=0; p<max_ply; offset += max_ply - p, p++)
+			sp.at(i)->ss[p].pv = &sp.at(i)->pv_table[offset];
+		if (use_qs_cache)
+			sp.at(i)->qtt   = new qs_tt(qs_tt_default_size);
 #if defined(ESP32)
 		sp.at(i)->md_limit      = 65535;
 #endif
@@ -511,6 +579,17 @@ auto hash_size_handler = [](const int value)  {
 	tti.set_size(uint64_t(value) * 1024 * 1024);
 };
 
+// a ponder search may still be using the caches
+auto qs_cache_handler = [](const bool value) {
+	stop_ponder();
+	use_qs_cache = value;
+	for(auto & i: sp) {
+		delete i->qtt;
+		i->qtt = value ? new qs_tt(qs_tt_default_size) : nullptr;
+	}
+	printf("# Thread-local QS cache %s\n", value ? "enabled" : "disabled");
+};
+
 bool allow_ponder         = false;
 auto allow_ponder_handler = [](const bool value) {
 	allow_ponder = value;
@@ -538,6 +617,29 @@ auto syzygy_option_handler = [](const std::string & value) {
 		with_syzygy = true;
 	}
 };
+
+// a ponder search may still be evaluating with the current network
+auto evalfile_option_handler = [](const std::string & value) {
+	stop_ponder();
+	if (nnue_load_network(value) == false)
+		return;
+
+	// accumulators and the evaluations stored in the tables came from the previous network
+	// (which may also have had a different hidden layer size)
+	for(auto & i: sp) {
+		delete i->nnue_eval;
+		i->nnue_eval = Eval::create(i->pos);
+		i->ecache->reset();
+		if (i->qtt)
+			i->qtt->reset();
+	}
+	tti.reset();
+};
+
+// for benchmarking: force the instruction set used by the NNUE code
+auto nnue_kernels_handler = [](const std::string & value) {
+	nnue_select_kernels(value);
+};
 #endif
 
 #if defined(ESP32)
@@ -665,6 +767,7 @@ void uci_hello() {
 	printf("???\n");
 #endif
 	printf("# Build type           : " BUILD_TYPE     "\n");
+	printf("# NNUE kernels         : %s\n", nnue_kernels_name());
 #if defined(INSTRUMENTED)
 	printf("# Build target         : " BUILD_TARGET   " (INSTRUMENTED!)\n");
 #else
@@ -715,9 +818,31 @@ void main_task()
 		printf("fen          show fen of current position\n");
 		printf("d / display  show current board layout\n");
 		printf("perft        perft, parameter is depth\n");
+#if !defined(ESP32)
+		printf("savett       write the transposition table to the file given as parameter\n");
+		printf("loadtt       read a transposition table written by savett (same Hash size and network)\n");
+#endif
 		printf("quit         exit to main menu\n");
 	};
 
+#if !defined(ESP32)
+	auto savett_handler = [](std::istringstream& line_stream) {
+		std::string file;
+		line_stream >> file;
+		stop_ponder();
+		if (tti.save(file, get_network_hash()))
+			printf("# TT saved to %s\n", file.c_str());
+	};
+
+	auto loadtt_handler = [](std::istringstream& line_stream) {
+		std::string file;
+		line_stream >> file;
+		stop_ponder();
+		if (tti.load(file, get_network_hash()))
+			printf("# TT loaded from %s\n", file.c_str());
+	};
+#endif
+
 	auto perft_handler = [](std::istringstream& line_stream) {
 		std::string temp;
 		line_stream >> temp;
@@ -728,10 +853,13 @@ void main_task()
 	auto ucinewgame_handler = [&global_cs](std::istringstream&) {
 		my_trace("# ucinewgame\n");
 		stop_ponder();
-		for(auto & i: sp)
+		for(auto & i: sp) {
 			memset(i->history, 0x00, history_malloc_size);
+			if (i->qtt)
+				i->qtt->reset();
+		}
 		global_cs.reset();
-		tti.reset();
+		tti.new_game();
 	};
 
 	auto position_handler = [](const libchess::UCIPositionParameters & position_parameters) {
@@ -900,8 +1028,7 @@ void main_task()
 
 					my_trace("# Syzygy hit %s with score %d\n", best_move.to_str().c_str(), best_score);
 
-					libchess::MoveList pv;
-					pv.add(best_move);
+					pv_t pv { &best_move, 1 };
 					printf("%s", emit_result(best_score, 0, { }, 0, { 0, 0 }, pv, false, think_time_max).c_str());
 				}
 			}
@@ -974,12 +1101,18 @@ void main_task()
 	};
 
 #if !defined(ESP32)
-	libchess::UCISpinOption thread_count_option("Threads", sp.size(), 1, 128, thread_count_handler);
+	libchess::UCISpinOption thread_count_option("Threads", sp.size(), 1, 1024, thread_count_handler);
 	uci_service->register_option(thread_count_option);
-	libchess::UCISpinOption hash_size_option("Hash", (tti.get_size() + 1023) / (1024 * 1024), 1, 1024, hash_size_handler);
+	libchess::UCISpinOption hash_size_option("Hash", (tti.get_size() + 1023) / (1024 * 1024), 1, 262144, hash_size_handler);
 	uci_service->register_option(hash_size_option);
+	libchess::UCICheckOption qs_cache_option("QSCache", use_qs_cache, qs_cache_handler);
+	uci_service->register_option(qs_cache_option);
 	libchess::UCIStringOption syzygy_path_option("SyzygyPath", "", syzygy_option_handler);
 	uci_service->register_option(syzygy_path_option);
+	libchess::UCIStringOption evalfile_option("EvalFile", "<embedded>", evalfile_option_handler);
+	uci_service->register_option(evalfile_option);
+	libchess::UCIStringOption nnue_kernels_option("NNUEKernels", "auto", nnue_kernels_handler);
+	uci_service->register_option(nnue_kernels_option);
 #endif
 	libchess::UCICheckOption allow_ponder_option("Ponder", allow_ponder, allow_ponder_handler);
 	uci_service->register_option(allow_ponder_option);
@@ -1006,6 +1139,10 @@ void main_task()
 	uci_service->register_handler("perft",      perft_handler, true);
 	uci_service->register_handler("ucinewgame", ucinewgame_handler, true);
 	uci_service->register_handler("status",     status_handler, false);
+#if !defined(ESP32)
+	uci_service->register_handler("savett",     savett_handler, true);
+	uci_service->register_handler("loadtt",     loadtt_handler, true);
+#endif
 	uci_service->register_handler("help",       help_handler, false);
 
 	for(;;) {
@@ -1062,8 +1199,11 @@ void main_task()
 void run_bench(const bool long_bench, const bool via_usb)
 {
 	reset_search_statistics();
-	tti.reset();
+	tti.new_game();
 
+#if defined(ALLOC_COUNT)
+	alloc_count = 0;  // only the allocations of this bench
+#endif
 	uint64_t start_ts = esp_timer_get_time();
 
 	if (long_bench) {
@@ -1223,6 +1363,14 @@ void run_bench(const bool long_bench, const bool via_usb)
 
 	uint64_t end_ts     = esp_timer_get_time();
 
+#if defined(ALLOC_COUNT)
+	if (alloc_count) {
+		printf("# FAIL: %" PRIu64 " heap allocation(s) while searching\n", alloc_count.load());
+		exit(1);
+	}
+	printf("# no heap allocations while searching\n");
+#endif
+
 	uint64_t node_count = sp.at(0)->cs.data.nodes + sp.at(0)->cs.data.qnodes;
 	uint64_t t_diff     = end_ts - start_ts;
 
@@ -1250,6 +1398,8 @@ void help()
 	printf("-p    allow pondering\n");
 	printf("-s x  set path to Syzygy\n");
 	printf("-H x  set size of hashtable to x MB\n");
+	printf("-N x  load NNUE network from file x (quantised.bin format)\n");
+	printf("-K x  NNUE kernels: auto (default), generic, avx2 or avx512\n");
 	printf("-R x  trace to file x\n");
 	printf("-b x  select polyglot format opening book\n");
 	printf("-r    enable tracing to screen\n");
@@ -1274,7 +1424,7 @@ int main(int argc, char *argv[])
 	bool tui          = false;
 	int  thread_count =  1;
 	int  c            = -1;
-	while((c = getopt(argc, argv, "b:Tt:ps:UR:rH:Q:h")) != -1) {
+	while((c = getopt(argc, argv, "b:Tt:ps:UR:rH:N:K:Q:h")) != -1) {
 		if (c == 'U') {
 			run_tests();
 			return 1;
@@ -1313,7 +1463,17 @@ int main(int argc, char *argv[])
                 else if (c == 'r')
                         trace_enabled = true;
 		else if (c == 'H')
-			tti.set_size(uint64_t(atol(optarg)) * 1024 * 1024);
+			tti.set_size(strtoull(optarg, nullptr, 10) * 1024 * 1024);
+		else if (c == 'N') {
+			if (!nnue_load_network(optarg)) {
+				printf("Cannot load network \"%s\".\n", optarg);
+				return 1;
+			}
+		}
+		else if (c == 'K') {
+			if (!nnue_select_kernels(optarg))
+				return 1;
+		}
 		else {
 			help();
 
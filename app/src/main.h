@@ -24,6 +24,52 @@ typedef struct {
 #include <freertos/task.h>
 #endif
 
+class eval_cache;
+class qs_tt;
+
+// deepest ply search() and qs() go, the search stack is sized for it
+#if defined(ESP32)
+constexpr int max_ply = 64;
+#else
+constexpr int max_ply = 128;
+#endif
+constexpr int max_moves = 256;  // capacity of a libchess::MoveList
+
+// a PV, e.g. a row of the triangular PV table (the PV from a ply onwards)
+typedef struct
+{
+	const libchess::Move *moves;
+	int                   length;
+} pv_t;
+
+// row p has max_ply - p entries: a PV from ply p is at most that long
+constexpr size_t pv_table_size = max_ply * (max_ply + 1) / 2;
+
+// what search() and qs() know about the node at a ply. Preallocated (per
+// thread) so that searching does not allocate. A node clears the entry of
+// the next ply before making a move; re-searches of the same node (LMR, PVS,
+// null move verification) find e.g. the static eval already set.
+typedef struct
+{
+	int                        static_eval;              // TT_NO_EVAL (tt.h) when not known
+	bool                       in_check      { false };  // set by the node itself
+	uint8_t                    null_moves    { 0     };  // on the path from the root
+	libchess::Move             move          {       };  // made at this ply, 0 for a null move
+	libchess::Move             excluded_move {       };  // skipped by search() (e.g. singular extensions)
+	int                        reduction     { 0     };  // of the search after move (< 0: extension)
+	std::array<int, max_moves> move_scores;              // of the move_picker of this ply
+	libchess::Move            *pv            { nullptr };  // row of the PV table, set by search()
+	int                        pv_length     { 0     };
+} search_stack_t;
+
+// Per search thread: max_ply stack entries (mostly the move scores) plus the
+// PV table. That is about 75 kB on the ESP32 (PSRAM when there is some:
+// CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL) and 170 kB elsewhere.
+constexpr size_t search_stack_bytes = max_ply * sizeof(search_stack_t) + pv_table_size * sizeof(libchess::Move);
+#if defined(ESP32)
+static_assert(search_stack_bytes <= 80 * 1024, "search stack too large for the ESP32");
+#endif
+
 typedef struct
 {
 	int16_t   *const history   { nullptr };
@@ -32,6 +78,7 @@ typedef struct
 	chess_stats      cs        {         };
 	uint32_t         cur_move  { 0       };
 	uint16_t         md        { 0       };
+	uint16_t         ply       { 0       };  // distance to the root
 #if defined(ESP32)
 	TaskHandle_t     th        { nullptr };
 	uint16_t         md_limit  { 65535   };
@@ -42,6 +89,10 @@ typedef struct
 
 	std::thread     *thread_handle { nullptr };
 	Eval            *nnue_eval     { nullptr };
+	qs_tt           *qtt           { nullptr };  // only when the QSCache option is enabled, else qs() uses tti
+	eval_cache      *ecache        { nullptr };
+	search_stack_t  *ss            { nullptr };  // max_ply entries, index: ply
+	libchess::Move  *pv_table      { nullptr };  // pv_table_size entries
 } search_pars_t;
 
 extern std::vector<search_pars_t *> sp;
@@ -75,6 +126,13 @@ void vTaskGetRunTimeStats();
 #define IRAM_ATTR
 #endif
 
+#if defined(ALLOC_COUNT)
+// the heap allocations made while a thread has alloc_counting set (see
+// search_it() and run_bench())
+extern thread_local bool    alloc_counting;
+extern std::atomic_uint64_t alloc_count;
+#endif
+
 void set_led(const uint8_t r, const uint8_t g, const uint8_t b);
 void my_trace(const char *const fmt, ...);
 void set_flag(end_t *const stop);
@@ -0,0 +1,200 @@
+// The NNUE kernels for one instruction set. nnue.cpp includes this once per
+// set (hence no include guard), each time in its own namespace and with
+// KERNEL_ISA_xxx, KERNEL_TARGET and KERNEL_NAME defined. Without a
+// KERNEL_ISA_xxx the scalar code is used (ESP32, ARM, ...). H is the size
+// of the hidden layer, the loops over it are unrolled (KERNEL_UNROLL).
+//
+// All versions give bit-identical results: see test.cpp and
+// nnue_evaluate_reference().
+
+#if defined(KERNEL_ISA_AVX512)
+using vec_t = __m512i;
+#define vec_zero()          _mm512_setzero_si512()
+#define vec_set1_16(v)      _mm512_set1_epi16(v)
+#define vec_load(p)         _mm512_load_si512(reinterpret_cast<const vec_t *>(p))
+#define vec_store(p, v)     _mm512_store_si512(reinterpret_cast<vec_t *>(p), v)
+#define vec_add_16(a, b)    _mm512_add_epi16(a, b)
+#define vec_sub_16(a, b)    _mm512_sub_epi16(a, b)
+#define vec_max_16(a, b)    _mm512_max_epi16(a, b)
+#define vec_min_16(a, b)    _mm512_min_epi16(a, b)
+#define vec_mullo_16(a, b)  _mm512_mullo_epi16(a, b)
+#define vec_load_8to16(p)   _mm512_cvtepi8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i *>(p)))
+#if defined(__AVX512VNNI__)
+#define vec_dpwssd_32(s, a, b) _mm512_dpwssd_epi32(s, a, b)
+#else
+#define vec_dpwssd_32(s, a, b) _mm512_add_epi32(s, _mm512_madd_epi16(a, b))
+#endif
+// by hand, as for AVX2: with GCC 12 _mm512_reduce_add_epi32 (and the plain
+// 512 -> 256 bit casts/extracts) warn about an uninitialised operand, the
+// zero-masked extracts have none
+KERNEL_TARGET static inline int vec_reduce_add_32(const __m512i v)
+{
+	__m256i sum256 = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xf, v, 0), _mm512_maskz_extracti64x4_epi64(0xf, v, 1));
+	__m128i sum    = _mm_add_epi32(_mm256_castsi256_si128(sum256), _mm256_extracti128_si256(sum256, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum);
+}
+#define USE_SIMD
+#elif defined(KERNEL_ISA_AVX2)
+using vec_t = __m256i;
+#define vec_zero()          _mm256_setzero_si256()
+#define vec_set1_16(v)      _mm256_set1_epi16(v)
+#define vec_load(p)         _mm256_load_si256(reinterpret_cast<const vec_t *>(p))
+#define vec_store(p, v)     _mm256_store_si256(reinterpret_cast<vec_t *>(p), v)
+#define vec_add_16(a, b)    _mm256_add_epi16(a, b)
+#define vec_sub_16(a, b)    _mm256_sub_epi16(a, b)
+#define vec_max_16(a, b)    _mm256_max_epi16(a, b)
+#define vec_min_16(a, b)    _mm256_min_epi16(a, b)
+#define vec_mullo_16(a, b)  _mm256_mullo_epi16(a, b)
+#define vec_load_8to16(p)   _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(p)))
+#define vec_dpwssd_32(s, a, b) _mm256_add_epi32(s, _mm256_madd_epi16(a, b))
+KERNEL_TARGET static inline int vec_reduce_add_32(const __m256i v)
+{
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum);
+}
+#define USE_SIMD
+#elif defined(KERNEL_ISA_SSE2)
+// everything used here is SSE2, so this also covers the SSE4.1 builds
+using vec_t = __m128i;
+#define vec_zero()          _mm_setzero_si128()
+#define vec_set1_16(v)      _mm_set1_epi16(v)
+#define vec_load(p)         _mm_load_si128(reinterpret_cast<const vec_t *>(p))
+#define vec_store(p, v)     _mm_store_si128(reinterpret_cast<vec_t *>(p), v)
+#define vec_add_16(a, b)    _mm_add_epi16(a, b)
+#define vec_sub_16(a, b)    _mm_sub_epi16(a, b)
+#define vec_max_16(a, b)    _mm_max_epi16(a, b)
+#define vec_min_16(a, b)    _mm_min_epi16(a, b)
+#define vec_mullo_16(a, b)  _mm_mullo_epi16(a, b)
+#define vec_dpwssd_32(s, a, b) _mm_add_epi32(s, _mm_madd_epi16(a, b))
+KERNEL_TARGET static inline int vec_reduce_add_32(const __m128i v)
+{
+	__m128i sum = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum);
+}
+// no pmovsxbw in SSE2: put each byte in the upper half of a lane, then shift it down
+KERNEL_TARGET static inline __m128i vec_load_8to16(const std::int8_t *const p)
+{
+	__m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+	return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+}
+#define USE_SIMD
+#endif
+
+#if defined(USE_SIMD)
+constexpr int I16_PER_VEC = sizeof(vec_t) / sizeof(int16_t);
+
+#if defined(NNUE_INT8)
+#define vec_load_ft(p)      vec_load_8to16(p)
+#else
+#define vec_load_ft(p)      vec_load(p)
+#endif
+#endif
+
+// SCReLU: clamp(x, 0, QA)^2 * w. As in the scalar version, input * w is
+// truncated to 16 bit first; madd then multiplies that by the input once
+// more and sums pairs of lanes into 32 bit.
+template<int H>
+KERNEL_TARGET static int screlu_dot(const std::int16_t *const acc, const std::int16_t *const weights)
+{
+#if defined(USE_SIMD)
+	static_assert(H % I16_PER_VEC == 0, "the hidden layer size must be a multiple of the vector width");
+	const vec_t zero = vec_zero();
+	const vec_t qa   = vec_set1_16(QA);
+	vec_t       sum  = vec_zero();
+	KERNEL_UNROLL
+	for (int i = 0; i < H; i += I16_PER_VEC) {
+		vec_t input  = vec_min_16(vec_max_16(vec_load(&acc[i]), zero), qa);
+		vec_t weight = vec_mullo_16(input, vec_load(&weights[i]));
+		sum = vec_dpwssd_32(sum, input, weight);
+	}
+	return vec_reduce_add_32(sum);
+#else
+	int output = 0;
+	for (int i = 0; i < H; i++) {
+		std::int16_t input  = std::clamp(acc[i], std::int16_t{0}, QA);
+		std::int16_t weight = input * weights[i];
+		output += int{input} * int{weight};
+	}
+	return output;
+#endif
+}
+
+template<int H>
+KERNEL_TARGET static void add(std::int16_t *const acc, const ft_weight_t *const w)
+{
+#if defined(USE_SIMD)
+	KERNEL_UNROLL
+	for (int i = 0; i < H; i += I16_PER_VEC)
+		vec_store(&acc[i], vec_add_16(vec_load(&acc[i]), vec_load_ft(&w[i])));
+#else
+	for (int i = 0; i < H; i++)
+		acc[i] += w[i];
+#endif
+}
+
+template<int H>
+KERNEL_TARGET static void sub(std::int16_t *const acc, const ft_weight_t *const w)
+{
+#if defined(USE_SIMD)
+	KERNEL_UNROLL
+	for (int i = 0; i < H; i += I16_PER_VEC)
+		vec_store(&acc[i], vec_sub_16(vec_load(&acc[i]), vec_load_ft(&w[i])));
+#else
+	for (int i = 0; i < H; i++)
+		acc[i] -= w[i];
+#endif
+}
+
+template<int H>
+KERNEL_TARGET static void sub_add(std::int16_t *const out, const std::int16_t *const in, const ft_weight_t *const s, const ft_weight_t *const a)
+{
+#if defined(USE_SIMD)
+	KERNEL_UNROLL
+	for (int i = 0; i < H; i += I16_PER_VEC)
+		vec_store(&out[i], vec_add_16(vec_sub_16(vec_load(&in[i]), vec_load_ft(&s[i])), vec_load_ft(&a[i])));
+#else
+	for (int i = 0; i < H; i++)
+		out[i] = in[i] - s[i] + a[i];
+#endif
+}
+
+template<int H>
+KERNEL_TARGET static void sub_sub_add(std::int16_t *const out, const std::int16_t *const in, const ft_weight_t *const s1, const ft_weight_t *const s2, const ft_weight_t *const a)
+{
+#if defined(USE_SIMD)
+	KERNEL_UNROLL
+	for (int i = 0; i < H; i += I16_PER_VEC)
+		vec_store(&out[i], vec_add_16(vec_sub_16(vec_sub_16(vec_load(&in[i]), vec_load_ft(&s1[i])), vec_load_ft(&s2[i])), vec_load_ft(&a[i])));
+#else
+	for (int i = 0; i < H; i++)
+		out[i] = in[i] - s1[i] - s2[i] + a[i];
+#endif
+}
+
+template<int H>
+const nnue_kernels kernels { KERNEL_NAME, screlu_dot<H>, add<H>, sub<H>, sub_add<H>, sub_sub_add<H> };
+
+#undef vec_zero
+#undef vec_set1_16
+#undef vec_load
+#undef vec_store
+#undef vec_add_16
+#undef vec_sub_16
+#undef vec_max_16
+#undef vec_min_16
+#undef vec_mullo_16
+#undef vec_load_8to16
+#undef vec_dpwssd_32
+#undef vec_reduce_add_32
+#undef vec_load_ft
+#undef USE_SIMD
+#undef KERNEL_ISA_AVX512
+#undef KERNEL_ISA_AVX2
+#undef KERNEL_ISA_SSE2
+#undef KERNEL_TARGET
+#undef KERNEL_NAME
@@ -0,0 +1,52 @@
+#! /usr/bin/env python3
+
+# converts a quantised.bin (int16 feature transformer, QA=255) into the
+# network layout of a NNUE_INT8=1 build: int8 feature weights with QA=110
+#
+# nnue-to-int8.py quantised-big.bin 256 quantised-big-int8.bin
+# (load it with -N or EvalFile; the embedded network is requantised the same
+# way when a NNUE_INT8=1 build starts)
+
+import struct
+import sys
+
+QA_IN = 255
+QA_OUT = 110  # must match QA in nnue.h
+N_FEATURES = 2 * 6 * 64
+
+def align(n):
+    return (n + 63) // 64 * 64
+
+def requantise(v, lo, hi):
+    return max(lo, min(hi, round(v * QA_OUT / QA_IN)))
+
+if len(sys.argv) != 4:
+    print(f'Usage: {sys.argv[0]} quantised.bin hidden-size out.bin')
+    sys.exit(1)
+
+hidden = int(sys.argv[2])
+
+data = open(sys.argv[1], 'rb').read()
+n = N_FEATURES * hidden + hidden + 2 * hidden + 1
+if len(data) != align(n * 2):
+    print(f'{sys.argv[1]} is {len(data)} bytes, expected {align(n * 2)} for a hidden size of {hidden}')
+    sys.exit(1)
+
+values = struct.unpack_from(f'<{n}h', data)
+feature_weights = values[0:N_FEATURES * hidden]
+feature_bias = values[N_FEATURES * hidden:N_FEATURES * hidden + hidden]
+output_weights = values[N_FEATURES * hidden + hidden:-1]
+output_bias = values[-1]
+
+# QA scales the feature transformer; the output layer (QB) stays as-is, its bias is in QA * QB units
+out = struct.pack(f'<{len(feature_weights)}b', *[requantise(v, -128, 127) for v in feature_weights])
+out += struct.pack(f'<{hidden}h', *[requantise(v, -32768, 32767) for v in feature_bias])
+out += struct.pack(f'<{len(output_weights)}h', *output_weights)
+out += struct.pack('<h', requantise(output_bias, -32768, 32767))
+out += bytes(align(len(out)) - len(out))
+
+n_clipped = sum(1 for v in feature_weights if abs(v * QA_OUT / QA_IN) > 127.5)
+print(f'{n_clipped} of {len(feature_weights)} feature weights clipped')
+
+with open(sys.argv[3], 'wb') as fh:
+    fh.write(out)
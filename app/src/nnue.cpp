@@ -1,7 +1,21 @@
 #include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
 #include <array>
 #include <cassert>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#if defined(linux) || defined(__APPLE__) || defined(__ANDROID__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "weights.cpp"
 #include "weights.h"
@@ -10,31 +24,211 @@
 #include "nnue.h"
 
 
-struct Network {
-	Accumulator feature_weights[2 * 6 * 64];
-	Accumulator feature_bias;
-	Accumulator output_weights[2];
-	std::int16_t output_bias;
+// The feature weights are the bulk of the network. With NNUE_INT8 they are
+// stored as int8 (see nnue-to-int8.py), halving the network and what the
+// accumulator updates pull through the caches. The kernels sign-extend them
+// to int16 on every load (vec_load_ft), so the accumulators and the
+// arithmetic stay int16: no lanes are gained and the extra instruction makes
+// the updates slower when the int16 weights fit in the caches anyway.
+#if defined(NNUE_INT8)
+using ft_weight_t = std::int8_t;
+#else
+using ft_weight_t = std::int16_t;
+#endif
 
-	int evaluate(const Accumulator& us, const Accumulator& them) const {
-		static_assert(sizeof(Network) == weights_size);
+struct nnue_kernels
+{
+	const char *name;
+	int  (*screlu_dot )(const std::int16_t *const acc, const std::int16_t *const weights);
+	void (*add        )(std::int16_t *const acc, const ft_weight_t *const w);
+	void (*sub        )(std::int16_t *const acc, const ft_weight_t *const w);
+	void (*sub_add    )(std::int16_t *const out, const std::int16_t *const in, const ft_weight_t *const s, const ft_weight_t *const a);
+	void (*sub_sub_add)(std::int16_t *const out, const std::int16_t *const in, const ft_weight_t *const s1, const ft_weight_t *const s2, const ft_weight_t *const a);
+};
 
-		int output = 0;
+// What the build flags allow is always there. On x86 with GCC/clang the
+// AVX2 and AVX-512 versions are compiled in as well (using target
+// attributes), the best one the CPU has is selected at startup.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(ESP32)
+#define NNUE_DISPATCH
+#endif
 
-		// side to move
-		for (int i = 0; i < HIDDEN_SIZE; i++) {
-			std::int16_t input  = std::clamp(us.vals[i], std::int16_t{0}, QA);
-			std::int16_t weight = input * this->output_weights[0].vals[i];
-			output += int{input} * int{weight};
-		}
+#if defined(__SSE2__) || defined(NNUE_DISPATCH)
+#include <immintrin.h>
+#endif
+
+#if defined(__clang__)
+#define KERNEL_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define KERNEL_UNROLL _Pragma("GCC unroll 16")
+#else
+#define KERNEL_UNROLL
+#endif
+
+namespace generic {
+#if defined(__AVX512BW__)
+#define KERNEL_ISA_AVX512
+#define KERNEL_NAME "AVX-512 (build flags)"
+constexpr int level = 2;
+#elif defined(__AVX2__)
+#define KERNEL_ISA_AVX2
+#define KERNEL_NAME "AVX2 (build flags)"
+constexpr int level = 1;
+#elif defined(__SSE2__)
+#define KERNEL_ISA_SSE2
+#define KERNEL_NAME "SSE2"
+constexpr int level = 0;
+#else
+#define KERNEL_NAME "scalar"
+constexpr int level = 0;
+#endif
+#define KERNEL_TARGET
+#include "nnue-kernels.h"
+}
+
+#if defined(NNUE_DISPATCH)
+namespace avx2 {
+#define KERNEL_ISA_AVX2
+#define KERNEL_NAME "AVX2"
+#define KERNEL_TARGET __attribute__((target("avx2")))
+#include "nnue-kernels.h"
+}
+
+namespace avx512 {
+#define KERNEL_ISA_AVX512
+#define KERNEL_NAME "AVX-512"
+#define KERNEL_TARGET __attribute__((target("avx512f,avx512bw")))
+#include "nnue-kernels.h"
+}
+#endif
+
+// The hidden layer sizes this binary can run; the one of the network in use
+// selects the instance of the templates below. The embedded network has
+// HIDDEN_SIZE (weights.h).
+#if defined(ESP32)
+#define NNUE_HIDDEN_SIZES 128
+#else
+#define NNUE_HIDDEN_SIZES 128, 256, 512, 1024
+#endif
+
+// calls f(std::integral_constant<int, hidden_size>)
+template<int H, int... Hs, typename F>
+static auto for_hidden_size(const int hidden_size, F && f)
+{
+	if constexpr (sizeof...(Hs) == 0) {
+		assert(hidden_size == H);
+		return f(std::integral_constant<int, H>());
+	}
+	else {
+		if (hidden_size == H)
+			return f(std::integral_constant<int, H>());
+		return for_hidden_size<Hs...>(hidden_size, f);
+	}
+}
+
+enum kernel_level { KL_GENERIC, KL_AVX2, KL_AVX512 };
+
+// "auto" picks the best one this CPU can run; -1: not known/supported
+static int find_kernels(const std::string & name)
+{
+#if defined(NNUE_DISPATCH)
+	__builtin_cpu_init();  // this also runs from a static initializer
+	bool has_avx2   = __builtin_cpu_supports("avx2");
+	bool has_avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+
+	if (name == "auto") {
+		if (has_avx512 && generic::level < 2)
+			return KL_AVX512;
+		if (has_avx2 && generic::level < 1)
+			return KL_AVX2;
+		return KL_GENERIC;
+	}
+	if (name == "avx512")
+		return has_avx512 ? KL_AVX512 : -1;
+	if (name == "avx2")
+		return has_avx2 ? KL_AVX2 : -1;
+#else
+	if (name == "auto")
+		return KL_GENERIC;
+#endif
+	if (name == "generic")
+		return KL_GENERIC;
+
+	return -1;
+}
+
+template<int H>
+static const nnue_kernels *get_kernels(const int level)
+{
+#if defined(NNUE_DISPATCH)
+	if (level == KL_AVX512)
+		return &avx512::kernels<H>;
+	if (level == KL_AVX2)
+		return &avx2::kernels<H>;
+#endif
+	return &generic::kernels<H>;
+}
+
+static int kernels_selected = find_kernels("auto");
+
+template<int H>
+static const nnue_kernels *kernels = get_kernels<H>(find_kernels("auto"));
+
+template<int... Hs>
+static void set_kernels(const int level)
+{
+	((kernels<Hs> = get_kernels<Hs>(level)), ...);
+	kernels_selected = level;
+}
+
+template<int H>
+struct Accumulator
+{
+	alignas(64) std::array<std::int16_t, H> vals;
+};
+
+template<int H>
+struct FeatureWeights
+{
+	alignas(64) std::array<ft_weight_t, H> vals;
+};
+
+constexpr int n_inputs = 2 * 6 * 64;  // per king bucket
 
-		// not side to move
-		for (int i = 0; i < HIDDEN_SIZE; i++) {
-			std::int16_t input  = std::clamp(them.vals[i], std::int16_t{0}, QA);
-			std::int16_t weight = input * this->output_weights[1].vals[i];
+// the quantised.bin layout: feature weights (n_inputs per king bucket),
+// feature bias, output weights (us, them), output bias; padded to 64 bytes
+constexpr size_t network_size(const int hidden_size, const int king_buckets)
+{
+	size_t size = n_inputs * king_buckets * hidden_size * sizeof(ft_weight_t) + hidden_size * 2 + 2 * hidden_size * 2 + 2;
+	return (size + 63) / 64 * 64;
+}
+
+#if defined(NNUE_INT8)
+// the embedded network is the int16 one, requantised when the program starts
+static_assert((n_inputs * HIDDEN_SIZE * 2 + HIDDEN_SIZE * 2 + 2 * HIDDEN_SIZE * 2 + 2 + 63) / 64 * 64 == weights_size);
+#else
+static_assert(network_size(HIDDEN_SIZE, 1) == weights_size);
+#endif
+
+// a view on the weights in use (see set_network())
+template<int H>
+struct Network {
+	const FeatureWeights<H> *feature_weights;
+	const Accumulator<H>    *feature_bias;
+	const Accumulator<H>    *output_weights;  // 2
+	std::int16_t             output_bias;
+
+	static int screlu_dot_scalar(const Accumulator<H>& acc, const Accumulator<H>& weights) {
+		int output = 0;
+		for (int i = 0; i < H; i++) {
+			std::int16_t input  = std::clamp(acc.vals[i], std::int16_t{0}, QA);
+			std::int16_t weight = input * weights.vals[i];
 			output += int{input} * int{weight};
 		}
+		return output;
+	}
 
+	int finish(int output) const {
 		output /= int{QA};
 		output += this->output_bias;
 		output *= SCALE;
@@ -43,41 +237,281 @@ struct Network {
 		return std::clamp(output, -max_non_mate, max_non_mate);
 	}
 
-	void add_feature(Accumulator& acc, const int feature_idx) const {
-		for (int i = 0; i < HIDDEN_SIZE; i++) {
+	int evaluate(const Accumulator<H>& us, const Accumulator<H>& them) const {
+		// side to move + not side to move
+		return finish(kernels<H>->screlu_dot(us.vals.data(), this->output_weights[0].vals.data()) + kernels<H>->screlu_dot(them.vals.data(), this->output_weights[1].vals.data()));
+	}
+
+	int evaluate_scalar(const Accumulator<H>& us, const Accumulator<H>& them) const {
+		return finish(screlu_dot_scalar(us, this->output_weights[0]) + screlu_dot_scalar(them, this->output_weights[1]));
+	}
+
+	void add_feature(Accumulator<H>& acc, const int feature_idx) const {
+		kernels<H>->add(acc.vals.data(), this->feature_weights[feature_idx].vals.data());
+	}
+
+	void remove_feature(Accumulator<H>& acc, const int feature_idx) const {
+		kernels<H>->sub(acc.vals.data(), this->feature_weights[feature_idx].vals.data());
+	}
+
+	// The feature changes of a move, in one pass from 'in' to 'out'. The
+	// common shapes get their own kernel: sub-add (quiet move), sub-sub-add
+	// (capture, promotion, en passant) and sub-sub-add-add (castling, as two
+	// sub-adds). Undo pops the accumulator stack, so never comes here.
+	void update_features(Accumulator<H>& out, const Accumulator<H>& in, const int *const added, const int n_added, const int *const removed, const int n_removed) const {
+		const nnue_kernels *const k = kernels<H>;
+		auto w = [this](const int feature_idx) { return this->feature_weights[feature_idx].vals.data(); };
+
+		if (n_added == 1 && n_removed == 1)
+			k->sub_add(out.vals.data(), in.vals.data(), w(removed[0]), w(added[0]));
+		else if (n_added == 1 && n_removed == 2)
+			k->sub_sub_add(out.vals.data(), in.vals.data(), w(removed[0]), w(removed[1]), w(added[0]));
+		else if (n_added == 2 && n_removed == 2) {
+			k->sub_add(out.vals.data(), in.vals.data(),  w(removed[0]), w(added[0]));
+			k->sub_add(out.vals.data(), out.vals.data(), w(removed[1]), w(added[1]));
+		}
+		else {
+			out = in;
+			for (int i = 0; i < n_added; i++)
+				add_feature(out, added[i]);
+			for (int i = 0; i < n_removed; i++)
+				remove_feature(out, removed[i]);
+		}
+	}
+
+	void add_feature_scalar(Accumulator<H>& acc, const int feature_idx) const {
+		for (int i = 0; i < H; i++) {
 			acc.vals[i] += this->feature_weights[feature_idx].vals[i];
 		}
 	}
 
-	void remove_feature(Accumulator& acc, const int feature_idx) const {
-		for (int i = 0; i < HIDDEN_SIZE; i++) {
+	void remove_feature_scalar(Accumulator<H>& acc, const int feature_idx) const {
+		for (int i = 0; i < H; i++) {
 			acc.vals[i] -= this->feature_weights[feature_idx].vals[i];
 		}
 	}
 };
 
-const Network *const NNUE = reinterpret_cast<const Network *>(weights_data);
+// King buckets: with more than one, the inputs of a perspective depend on
+// where its king is: the board (as seen from that side) is mirrored
+// horizontally when the king is on the e-h files, the bucket then follows
+// from the king square on the a-d files. The trainer must use the same
+// table. The number of buckets comes from the size of the network file; one
+// bucket is the plain, unmirrored, 768 inputs layout of the embedded network.
+struct king_bucket_layout
+{
+	int     n;
+	uint8_t buckets[8 * 4];  // rank 1..8, file a..d
+};
+
+static constexpr king_bucket_layout king_bucket_layouts[] {
+	{ 1, { 0 } },
+	{ 2, { 0, 0, 0, 0,
+	       1, 1, 1, 1,
+	       1, 1, 1, 1,
+	       1, 1, 1, 1,
+	       1, 1, 1, 1,
+	       1, 1, 1, 1,
+	       1, 1, 1, 1,
+	       1, 1, 1, 1 } },
+	{ 4, { 0, 0, 1, 1,
+	       2, 2, 2, 2,
+	       3, 3, 3, 3,
+	       3, 3, 3, 3,
+	       3, 3, 3, 3,
+	       3, 3, 3, 3,
+	       3, 3, 3, 3,
+	       3, 3, 3, 3 } },
+	{ 8, { 0, 1, 2, 3,
+	       4, 4, 5, 5,
+	       6, 6, 6, 6,
+	       7, 7, 7, 7,
+	       7, 7, 7, 7,
+	       7, 7, 7, 7,
+	       7, 7, 7, 7,
+	       7, 7, 7, 7 } },
+	{ 16, {  0,  1,  2,  3,
+	         4,  5,  6,  7,
+	         8,  8,  9,  9,
+	        10, 10, 11, 11,
+	        12, 12, 13, 13,
+	        12, 12, 13, 13,
+	        14, 14, 15, 15,
+	        14, 14, 15, 15 } },
+};
 
-Eval::Eval()
+#if defined(NNUE_INT8)
+// the embedded network has int16 feature weights with QA=255: requantised
+// like nnue-to-int8.py does it for network files
+static const uint8_t *requantise_embedded()
 {
-	reset();
+	constexpr int    qa_in   = 255;
+	constexpr size_t n_ft    = n_inputs * HIDDEN_SIZE;
+	const int16_t   *in      = reinterpret_cast<const int16_t *>(weights_data);
+	uint8_t         *out     = new (std::align_val_t(64)) uint8_t[network_size(HIDDEN_SIZE, 1)] { };
+	auto             requant = [](const int v, const int lo, const int hi) { return std::clamp(int(std::lround(v * double(QA) / qa_in)), lo, hi); };
+
+	int8_t *ft = reinterpret_cast<int8_t *>(out);
+	for(size_t i=0; i<n_ft; i++)
+		ft[i] = int8_t(requant(in[i], INT8_MIN, INT8_MAX));
+
+	// feature bias (QA), output weights (QB, as-is) and output bias (QA * QB)
+	int16_t *rest = reinterpret_cast<int16_t *>(out + n_ft);
+	for(int i=0; i<HIDDEN_SIZE; i++)
+		rest[i] = int16_t(requant(in[n_ft + i], INT16_MIN, INT16_MAX));
+	for(int i=HIDDEN_SIZE; i<3 * HIDDEN_SIZE; i++)
+		rest[i] = in[n_ft + i];
+	rest[3 * HIDDEN_SIZE] = int16_t(requant(in[n_ft + 3 * HIDDEN_SIZE], INT16_MIN, INT16_MAX));
+
+	return out;
 }
 
-Eval::Eval(const libchess::Position & pos)
+static const uint8_t *const embedded_weights = requantise_embedded();
+#else
+static const uint8_t *const embedded_weights = weights_data;
+#endif
+constexpr size_t embedded_size = network_size(HIDDEN_SIZE, 1);
+
+// the embedded network unless one was loaded from a file
+static const void *nnue_weights      = embedded_weights;
+static int         nnue_hidden_size  = HIDDEN_SIZE;
+static const king_bucket_layout *nnue_king_buckets = &king_bucket_layouts[0];
+static size_t      nnue_size         = embedded_size;
+#if !defined(ESP32)
+static bool        nnue_from_file    = false;
+#endif
+static uint64_t    network_hash      = 0;  // 0: not calculated (yet)
+
+template<int H>
+static Network<H> network { };
+
+static void set_network()
 {
-	set(pos);
+	for_hidden_size<NNUE_HIDDEN_SIZES>(nnue_hidden_size, [](auto h) {
+			constexpr int H = decltype(h)::value;
+			const uint8_t *p = reinterpret_cast<const uint8_t *>(nnue_weights);
+			network<H>.feature_weights = reinterpret_cast<const FeatureWeights<H> *>(p);
+			p += n_inputs * nnue_king_buckets->n * sizeof(FeatureWeights<H>);
+			network<H>.feature_bias    = reinterpret_cast<const Accumulator<H> *>(p);
+			network<H>.output_weights  = network<H>.feature_bias + 1;
+			memcpy(&network<H>.output_bias, network<H>.output_weights + 2, sizeof network<H>.output_bias);
+		});
+}
+
+static const bool network_is_set = (set_network(), true);
+
+template<int H>
+static const Network<H> *get_network()
+{
+	assert(nnue_hidden_size == H);
+	return &network<H>;
 }
 
-void Eval::reset()
+// how the features of a perspective are numbered, this follows from the
+// position of its king
+struct perspective
 {
-	this->white = NNUE->feature_bias;
-	this->black = NNUE->feature_bias;
+	uint16_t base;  // n_inputs * bucket
+	uint8_t  flip;  // 7: mirrored horizontally
+};
+
+static perspective get_perspective(const int king_square, const bool white)
+{
+	if (nnue_king_buckets->n == 1)
+		return { 0, 0 };
+
+	int     sq   = white ? king_square : king_square ^ 56;
+	uint8_t flip = (sq & 7) >= 4 ? 7 : 0;
+	sq ^= flip;
+
+	return { uint16_t(n_inputs * nnue_king_buckets->buckets[(sq >> 3) * 4 + (sq & 7)]), flip };
+}
+
+static int feature_index(const perspective & p, const bool white, const int piece, const int square, const bool piece_is_white)
+{
+	return p.base + (piece_is_white == white ? 0 : 64 * 6) + 64 * piece + ((white ? square : square ^ 56) ^ p.flip);
+}
+
+// the accumulators of one ply and the feature changes that lead to them
+// from the previous ply; these are only applied when an evaluation needs them
+template<int H>
+struct eval_ply
+{
+	Accumulator<H>     white;
+	Accumulator<H>     black;
+
+	int                added_white  [2];
+	int                added_black  [2];
+	int                removed_white[2];
+	int                removed_black[2];
+	uint8_t            n_added;
+	uint8_t            n_removed;
+	bool               computed;
+
+	uint8_t            king[2];     // white, black
+	perspective        persp[2];
+	// a king move to another bucket (or the other half of the board): that
+	// side starts over from the pieces on the board (via the refresh cache)
+	bool               refresh[2];
+	libchess::Bitboard pieces[2][6];  // only set when refreshing
+};
+
+// The "Finny table": per perspective, bucket and mirroring the accumulator
+// of the last board that was refreshed with it. A refresh then only needs
+// the difference between that board and the current one, which is usually
+// a few pieces instead of all of them.
+template<int H>
+struct refresh_entry
+{
+	Accumulator<H>     acc;
+	libchess::Bitboard pieces[2][6];
+};
+
+// search() and qs() stop at max_ply, so the stack does not grow (allocate)
+// while searching
+constexpr size_t initial_stack_size = max_ply + 1;
+
+template<int H>
+class EvalT final : public Eval
+{
+private:
+	// one entry per ply: a move records its changes in the next entry,
+	// taking it back only steps back
+	mutable std::vector<eval_ply<H> >      stack;
+	size_t                                 ply { 0 };
+	// empty without king buckets
+	mutable std::vector<refresh_entry<H> > refresh_cache;
+
+	void materialize() const;
+	void refresh(Accumulator<H> & out, const eval_ply<H> & cur, const bool white) const;
+
+public:
+	EvalT(const libchess::Position & pos);
+
+	void reset() override;
+	void set_kings(const int white_king, const int black_king) override;
+
+	int  evaluate    (const bool white_to_move) const override;
+	void add_piece   (const int piece, const int square, const bool is_white) override;
+	void remove_piece(const int piece, const int square, const bool is_white) override;
+	void push        (const piece_change *const added, const int n_added, const piece_change *const removed, const int n_removed, const libchess::Position & pos) override;
+	bool pop         () override;
+};
+
+Eval *Eval::create(const libchess::Position & pos)
+{
+	return for_hidden_size<NNUE_HIDDEN_SIZES>(nnue_hidden_size, [&](auto h) -> Eval * { return new EvalT<decltype(h)::value>(pos); });
 }
 
 void Eval::set(const libchess::Position & pos)
 {
 	reset();
 
+	// the kings determine the features of all other pieces
+	libchess::Bitboard white_king = pos.piece_type_bb(libchess::constants::KING, libchess::constants::WHITE);
+	libchess::Bitboard black_king = pos.piece_type_bb(libchess::constants::KING, libchess::constants::BLACK);
+	set_kings(white_king ? int(white_king.forward_bitscan()) : 4, black_king ? int(black_king.forward_bitscan()) : 60);
+
         for(libchess::PieceType type : libchess::constants::PIECE_TYPES) {
                 libchess::Bitboard piece_bb_w = pos.piece_type_bb(type, libchess::constants::WHITE);
                 while (piece_bb_w) {
@@ -95,36 +529,412 @@ void Eval::set(const libchess::Position & pos)
         }
 }
 
-int IRAM_ATTR Eval::evaluate(const bool white_to_move) const
+template<int H>
+EvalT<H>::EvalT(const libchess::Position & pos)
 {
+	stack.resize(initial_stack_size);
+
+	if (nnue_king_buckets->n > 1) {
+		// 2 perspectives, mirrored or not
+		refresh_cache.resize(2 * nnue_king_buckets->n * 2);
+		for(auto & e: refresh_cache) {
+			e.acc = *get_network<H>()->feature_bias;
+			for(auto & color: e.pieces) {
+				for(auto & bb: color)
+					bb = libchess::Bitboard();
+			}
+		}
+	}
+
+	set(pos);
+}
+
+template<int H>
+void EvalT<H>::reset()
+{
+	const Network<H> *const network = get_network<H>();
+	ply = 0;
+	stack[0].white    = *network->feature_bias;
+	stack[0].black    = *network->feature_bias;
+	stack[0].computed = true;
+	set_kings(4, 60);
+}
+
+// only for an empty board: the features of the pieces already there are not redone
+template<int H>
+void EvalT<H>::set_kings(const int white_king, const int black_king)
+{
+	eval_ply<H> & cur = stack[ply];
+	cur.king [0] = white_king;
+	cur.king [1] = black_king;
+	cur.persp[0] = get_perspective(white_king, true );
+	cur.persp[1] = get_perspective(black_king, false);
+}
+
+template<int H>
+void EvalT<H>::refresh(Accumulator<H> & out, const eval_ply<H> & cur, const bool white) const
+{
+	const Network<H> *const network = get_network<H>();
+	const perspective     & p       = cur.persp[!white];
+	refresh_entry<H>      & e       = refresh_cache[((!white) * nnue_king_buckets->n + p.base / n_inputs) * 2 + (p.flip != 0)];
+
+	for(int color=0; color<2; color++) {
+		for(int type=0; type<6; type++) {
+			libchess::Bitboard add    = cur.pieces[color][type] & ~e.pieces[color][type];
+			libchess::Bitboard remove = e.pieces[color][type] & ~cur.pieces[color][type];
+			while(add) {
+				network->add_feature(e.acc, feature_index(p, white, type, add.forward_bitscan(), color == 0));
+				add.forward_popbit();
+			}
+			while(remove) {
+				network->remove_feature(e.acc, feature_index(p, white, type, remove.forward_bitscan(), color == 0));
+				remove.forward_popbit();
+			}
+			e.pieces[color][type] = cur.pieces[color][type];
+		}
+	}
+
+	out = e.acc;
+}
+
+// brings the accumulators of the current ply up to date, starting at the last ply that has them
+template<int H>
+void IRAM_ATTR EvalT<H>::materialize() const
+{
+	const Network<H> *const network = get_network<H>();
+
+	size_t first = ply;
+	while(stack[first].computed == false)
+		first--;  // stack[0] always is
+
+	for(size_t i=first + 1; i<=ply; i++) {
+		eval_ply<H>       & cur  = stack[i];
+		const eval_ply<H> & prev = stack[i - 1];
+		if (cur.refresh[0])
+			refresh(cur.white, cur, true);
+		else
+			network->update_features(cur.white, prev.white, cur.added_white, cur.n_added, cur.removed_white, cur.n_removed);
+		if (cur.refresh[1])
+			refresh(cur.black, cur, false);
+		else
+			network->update_features(cur.black, prev.black, cur.added_black, cur.n_added, cur.removed_black, cur.n_removed);
+		cur.computed = true;
+	}
+}
+
+template<int H>
+int IRAM_ATTR EvalT<H>::evaluate(const bool white_to_move) const
+{
+	if (stack[ply].computed == false)
+		materialize();
+
+	const eval_ply<H> & cur = stack[ply];
 	if (white_to_move)
-		return NNUE->evaluate(this->white, this->black);
+		return get_network<H>()->evaluate(cur.white, cur.black);
 
-	return NNUE->evaluate(this->black, this->white);
+	return get_network<H>()->evaluate(cur.black, cur.white);
 }
 
-void IRAM_ATTR Eval::add_piece(const int piece, const int square, const bool is_white)
+// a king is to be placed before the other pieces: see set_kings()
+template<int H>
+void IRAM_ATTR EvalT<H>::add_piece(const int piece, const int square, const bool is_white)
 {
 	assert(piece >= 0 && piece < 6);
-	if (is_white) {
-		NNUE->add_feature(this->white, 64 * piece + square);
-		NNUE->add_feature(this->black, 64 * (6 + piece) + (square ^ 56));
+	if (stack[ply].computed == false)
+		materialize();
+	const Network<H> *const network = get_network<H>();
+	eval_ply<H>           & cur     = stack[ply];
+	if (piece == libchess::constants::KING) {
+		cur.king [!is_white] = square;
+		cur.persp[!is_white] = get_perspective(square, is_white);
 	}
-	else {
-		NNUE->add_feature(this->black, 64 * piece + (square ^ 56));
-		NNUE->add_feature(this->white, 64 * (6 + piece) + square);
+	network->add_feature(cur.white, feature_index(cur.persp[0], true,  piece, square, is_white));
+	network->add_feature(cur.black, feature_index(cur.persp[1], false, piece, square, is_white));
+}
+
+template<int H>
+void IRAM_ATTR EvalT<H>::push(const piece_change *const added, const int n_added, const piece_change *const removed, const int n_removed, const libchess::Position & pos)
+{
+	if (ply + 1 == stack.size())
+		stack.resize(stack.size() * 2);
+	assert(n_added <= 2 && n_removed <= 2);
+
+	const eval_ply<H> & cur  = stack[ply];
+	eval_ply<H>       & next = stack[++ply];
+
+	next.king [0]   = cur.king [0];
+	next.king [1]   = cur.king [1];
+	next.persp[0]   = cur.persp[0];
+	next.persp[1]   = cur.persp[1];
+	next.refresh[0] = next.refresh[1] = false;
+
+	if (refresh_cache.empty() == false) {
+		for(int i=0; i<n_added; i++) {
+			auto & c = added[i];
+			if (c.piece != libchess::constants::KING)
+				continue;
+			perspective p = get_perspective(c.square, c.is_white);
+			next.king[!c.is_white] = c.square;
+			if (p.base != next.persp[!c.is_white].base || p.flip != next.persp[!c.is_white].flip) {
+				next.persp  [!c.is_white] = p;
+				next.refresh[!c.is_white] = true;
+				for(libchess::PieceType type : libchess::constants::PIECE_TYPES) {
+					next.pieces[0][type] = pos.piece_type_bb(type, libchess::constants::WHITE);
+					next.pieces[1][type] = pos.piece_type_bb(type, libchess::constants::BLACK);
+				}
+			}
+		}
+	}
+
+	for(int i=0; i<n_added; i++) {
+		auto & c = added[i];
+		next.added_white[i] = feature_index(next.persp[0], true,  c.piece, c.square, c.is_white);
+		next.added_black[i] = feature_index(next.persp[1], false, c.piece, c.square, c.is_white);
+	}
+	for(int i=0; i<n_removed; i++) {
+		auto & c = removed[i];
+		next.removed_white[i] = feature_index(next.persp[0], true,  c.piece, c.square, c.is_white);
+		next.removed_black[i] = feature_index(next.persp[1], false, c.piece, c.square, c.is_white);
 	}
+	next.n_added   = n_added;
+	next.n_removed = n_removed;
+	next.computed  = false;
 }
 
-void IRAM_ATTR Eval::remove_piece(const int piece, const int square, const bool is_white)
+template<int H>
+bool IRAM_ATTR EvalT<H>::pop()
+{
+	assert(ply > 0);
+	return stack[ply--].computed;
+}
+
+template<int H>
+void IRAM_ATTR EvalT<H>::remove_piece(const int piece, const int square, const bool is_white)
 {
 	assert(piece >= 0 && piece < 6);
-	if (is_white) {
-		NNUE->remove_feature(this->white, 64 * piece + square);
-		NNUE->remove_feature(this->black, 64 * (6 + piece) + (square ^ 56));
+	if (stack[ply].computed == false)
+		materialize();
+	const Network<H> *const network = get_network<H>();
+	eval_ply<H>           & cur     = stack[ply];
+	network->remove_feature(cur.white, feature_index(cur.persp[0], true,  piece, square, is_white));
+	network->remove_feature(cur.black, feature_index(cur.persp[1], false, piece, square, is_white));
+}
+
+// scalar and from scratch: what the vector kernels and the incremental updates are verified against
+template<int H>
+static int evaluate_reference(const libchess::Position & pos)
+{
+	const Network<H> *const network = get_network<H>();
+
+	Accumulator<H> white = *network->feature_bias;
+	Accumulator<H> black = *network->feature_bias;
+
+	libchess::Bitboard white_king = pos.piece_type_bb(libchess::constants::KING, libchess::constants::WHITE);
+	libchess::Bitboard black_king = pos.piece_type_bb(libchess::constants::KING, libchess::constants::BLACK);
+	perspective white_p = get_perspective(white_king ? int(white_king.forward_bitscan()) : 4,  true );
+	perspective black_p = get_perspective(black_king ? int(black_king.forward_bitscan()) : 60, false);
+
+	for(libchess::PieceType type : libchess::constants::PIECE_TYPES) {
+		libchess::Bitboard piece_bb_w = pos.piece_type_bb(type, libchess::constants::WHITE);
+		while (piece_bb_w) {
+			int sq = piece_bb_w.forward_bitscan();
+			piece_bb_w.forward_popbit();
+			network->add_feature_scalar(white, feature_index(white_p, true,  type, sq, true));
+			network->add_feature_scalar(black, feature_index(black_p, false, type, sq, true));
+		}
+
+		libchess::Bitboard piece_bb_b = pos.piece_type_bb(type, libchess::constants::BLACK);
+		while (piece_bb_b) {
+			int sq = piece_bb_b.forward_bitscan();
+			piece_bb_b.forward_popbit();
+			network->add_feature_scalar(black, feature_index(black_p, false, type, sq, false));
+			network->add_feature_scalar(white, feature_index(white_p, true,  type, sq, false));
+		}
 	}
-	else {
-		NNUE->remove_feature(this->black, 64 * piece + (square ^ 56));
-		NNUE->remove_feature(this->white, 64 * (6 + piece) + square);
+
+	if (pos.side_to_move() == libchess::constants::WHITE)
+		return network->evaluate_scalar(white, black);
+
+	return network->evaluate_scalar(black, white);
+}
+
+int nnue_evaluate_reference(const libchess::Position & pos)
+{
+	return for_hidden_size<NNUE_HIDDEN_SIZES>(nnue_hidden_size, [&](auto h) { return evaluate_reference<decltype(h)::value>(pos); });
+}
+
+int get_network_size()
+{
+	return int(nnue_size);
+}
+
+int get_network_size(const int hidden_size, const int king_buckets)
+{
+	for(int h: { NNUE_HIDDEN_SIZES }) {
+		for(auto & layout: king_bucket_layouts) {
+			if (h == hidden_size && layout.n == king_buckets)
+				return int(network_size(hidden_size, king_buckets));
+		}
+	}
+
+	return 0;
+}
+
+int get_network_hidden_size()
+{
+	return nnue_hidden_size;
+}
+
+int get_network_king_buckets()
+{
+	return nnue_king_buckets->n;
+}
+
+// FNV-1a of the weights, used to tie data derived from them (e.g. a saved TT) to this network
+uint64_t get_network_hash()
+{
+	if (network_hash == 0) {
+		const uint8_t *const p = reinterpret_cast<const uint8_t *>(nnue_weights);
+		uint64_t h = 0xcbf29ce484222325ull;
+		for(size_t i=0; i<nnue_size; i++) {
+			h ^= p[i];
+			h *= 0x100000001b3ull;
+		}
+		network_hash = h;
+	}
+
+	return network_hash;
+}
+
+#if !defined(ESP32)
+// the hidden layer size and king buckets of a network file of this many
+// bytes (the sizes of all combinations differ); false if none fits
+static bool get_layout(const size_t size, int *const hidden_size, const king_bucket_layout **const layout)
+{
+	for(int h: { NNUE_HIDDEN_SIZES }) {
+		for(auto & l: king_bucket_layouts) {
+			if (network_size(h, l.n) == size) {
+				*hidden_size = h;
+				*layout      = &l;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static void nnue_unload_network()
+{
+	if (nnue_from_file) {
+#if defined(linux) || defined(__APPLE__) || defined(__ANDROID__)
+		munmap(const_cast<void *>(nnue_weights), nnue_size);
+#else
+		::operator delete(const_cast<void *>(nnue_weights), std::align_val_t(64));
+#endif
+		nnue_from_file = false;
 	}
+
+	nnue_weights      = embedded_weights;
+	nnue_hidden_size  = HIDDEN_SIZE;
+	nnue_king_buckets = &king_bucket_layouts[0];
+	nnue_size         = embedded_size;
+	network_hash      = 0;
+	set_network();
+}
+
+bool nnue_load_network(const std::string & file)
+{
+	if (file.empty() || file == "<embedded>") {
+		nnue_unload_network();
+		printf("# Using embedded network\n");
+		return true;
+	}
+
+#if defined(linux) || defined(__APPLE__) || defined(__ANDROID__)
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd == -1) {
+		printf("# Cannot open network %s: %s\n", file.c_str(), strerror(errno));
+		return false;
+	}
+
+	struct stat st { };
+	int                       hidden_size = 0;
+	const king_bucket_layout *layout      = nullptr;
+	if (fstat(fd, &st) == -1 || get_layout(st.st_size, &hidden_size, &layout) == false) {
+		printf("# %s is not a network for this build (%lld bytes, does not fit any of the supported hidden layer sizes and king buckets)\n", file.c_str(), static_cast<long long>(st.st_size));
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+
+	// read-only & shared: all instances of Dog using this file share the pages from the page cache
+	void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		printf("# Cannot map network %s: %s\n", file.c_str(), strerror(errno));
+		return false;
+	}
+#else
+	FILE *fh = fopen(file.c_str(), "rb");
+	if (!fh) {
+		printf("# Cannot open network %s: %s\n", file.c_str(), strerror(errno));
+		return false;
+	}
+
+	fseek(fh, 0, SEEK_END);
+	size_t                    size        = ftell(fh);
+	int                       hidden_size = 0;
+	const king_bucket_layout *layout      = nullptr;
+	fseek(fh, 0, SEEK_SET);
+	if (get_layout(size, &hidden_size, &layout) == false) {
+		printf("# %s is not a network for this build (%zu bytes, does not fit any of the supported hidden layer sizes and king buckets)\n", file.c_str(), size);
+		fclose(fh);
+		return false;
+	}
+
+	void *p  = ::operator new(size, std::align_val_t(64));
+	bool  ok = fread(p, 1, size, fh) == size;
+	fclose(fh);
+	if (!ok) {
+		printf("# Cannot read network %s\n", file.c_str());
+		::operator delete(p, std::align_val_t(64));
+		return false;
+	}
+#endif
+
+	nnue_unload_network();
+	nnue_weights      = p;
+	nnue_hidden_size  = hidden_size;
+	nnue_king_buckets = layout;
+	nnue_size         = size;
+	nnue_from_file    = true;
+	set_network();
+	printf("# Loaded network %s (hidden layer size %d, %d king bucket(s), hash %016" PRIx64 ")\n", file.c_str(), hidden_size, layout->n, get_network_hash());
+
+	return true;
+}
+#endif
+
+const char *nnue_kernels_name()
+{
+	return get_kernels<HIDDEN_SIZE>(kernels_selected)->name;
+}
+
+bool nnue_select_kernels(const std::string & name)
+{
+	int level = find_kernels(name);
+	if (level == -1) {
+		printf("# NNUE kernels \"%s\" not known or not supported by this CPU (auto, generic"
+#if defined(NNUE_DISPATCH)
+				", avx2, avx512"
+#endif
+				")\n", name.c_str());
+		return false;
+	}
+
+	set_kernels<NNUE_HIDDEN_SIZES>(level);
+	printf("# NNUE kernels: %s\n", nnue_kernels_name());
+
+	return true;
 }
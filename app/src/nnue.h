@@ -1,34 +1,69 @@
 #pragma once
 
+#include <string>
+#include <vector>
 #include <libchess/Position.h>
 
 #include "weights.h"
 
 
 constexpr int SCALE = 400;
+#if defined(NNUE_INT8)
+#if defined(ESP32)
+#error "NNUE_INT8 is for the desktop network only"
+#endif
+constexpr std::int16_t QA = 110;  // int8 feature weights, see nnue-to-int8.py
+#else
 constexpr std::int16_t QA = 255;
+#endif
 constexpr std::int16_t QB = 64;
 
-struct Accumulator
+struct piece_change
 {
-    alignas(64) std::array<std::int16_t, HIDDEN_SIZE> vals;
+	int  piece;  // 0...5
+	int  square;
+	bool is_white;
 };
 
+// The accumulators are sized for the hidden layer of the network in use,
+// create() returns the implementation for that size. A network change
+// (nnue_load_network()) requires new instances.
 class Eval
 {
-private:
-	Accumulator white;
-	Accumulator black;
-
-	Eval();
-
 public:
-	Eval(const libchess::Position & pos);
+	virtual ~Eval() = default;
+
+	static Eval *create(const libchess::Position & pos);
 
-	void reset();
+	virtual void reset() = 0;
 	void set(const libchess::Position & pos);
+	// with king buckets, the features of a side depend on where its king is
+	virtual void set_kings(const int white_king, const int black_king) = 0;
 
-	int  evaluate    (const bool white_to_move) const;
-	void add_piece   (const int piece, const int square, const bool is_white);
-	void remove_piece(const int piece, const int square, const bool is_white);
+	virtual int  evaluate    (const bool white_to_move) const = 0;
+	virtual void add_piece   (const int piece, const int square, const bool is_white) = 0;
+	virtual void remove_piece(const int piece, const int square, const bool is_white) = 0;
+	// records the pieces added/removed by a move; pos is the position after
+	// it, needed when a king moves to another bucket
+	virtual void push        (const piece_change *const added, const int n_added, const piece_change *const removed, const int n_removed, const libchess::Position & pos) = 0;
+	// returns false if the accumulators of that ply were never computed
+	virtual bool pop         () = 0;
 };
+
+// "auto" (the default), "generic" (what the build flags allow) or, on x86, "avx2"/"avx512";
+// returns false if not known or not supported by this CPU (and keeps the current ones)
+bool        nnue_select_kernels(const std::string & name);
+const char *nnue_kernels_name();
+
+int      nnue_evaluate_reference(const libchess::Position & pos);
+int      get_network_size();  // in bytes
+int      get_network_size(const int hidden_size, const int king_buckets = 1);  // 0 if not supported by this build
+int      get_network_hidden_size();
+int      get_network_king_buckets();
+uint64_t get_network_hash();
+#if !defined(ESP32)
+// maps a network in the quantised.bin format (any of the hidden layer sizes
+// this build supports, see nnue.cpp); keeps the current one on failure.
+// "" or "<embedded>" switches back to the network built into the binary
+bool     nnue_load_network(const std::string & file);
+#endif
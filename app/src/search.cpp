@@ -103,6 +103,102 @@ int sort_movelist_compare::move_evaluater(const libchess::Move move) const
 	return score;
 }
 
+move_picker::move_picker(search_pars_t & sp, const std::optional<libchess::Move> & tt_move, const bool with_quiets, const bool in_check) :
+	sp(sp),
+	smc(sp),
+	with_quiets(with_quiets),
+	in_check(in_check),
+	tt_move(tt_move),
+	move_scores(sp.ss[sp.ply].move_scores)
+{
+}
+
+void move_picker::add_first_move(const libchess::Move move)
+{
+	smc.add_first_move(move);
+}
+
+void move_picker::score_moves()
+{
+	assert(move_list.size() <= max_moves);
+	for(int i=m_idx; i<move_list.size(); i++)
+		move_scores[i] = smc.move_evaluater(*(move_list.begin() + i));
+}
+
+// selection sort, one step at a time: mostly only the first few moves are needed
+std::optional<libchess::Move> move_picker::select()
+{
+	int n_moves = move_list.size();
+	while(m_idx < n_moves) {
+		int selected_idx = m_idx;
+		for(int i=m_idx; i<n_moves; i++) {
+			if (move_scores[i] > move_scores[selected_idx])
+				selected_idx = i;
+		}
+
+		std::swap(move_scores[selected_idx], move_scores[m_idx]);
+		std::swap(*(move_list.begin() + selected_idx), *(move_list.begin() + m_idx));
+
+		auto & move = *(move_list.begin() + m_idx);
+		m_idx++;
+
+		if (move == tt_move)  // already returned
+			continue;
+		if (sp.pos.is_legal_generated_move(move) == false)
+			continue;
+
+		return move;
+	}
+
+	return { };
+}
+
+std::optional<libchess::Move> move_picker::next()
+{
+	for(;;) {
+		switch(stage) {
+			case S_TT:
+				stage = S_GEN_NOISY;
+				if (tt_move.has_value())
+					return tt_move;
+				break;
+			case S_GEN_NOISY:
+				if (in_check)  // evasions: everything
+					move_list = sp.pos.pseudo_legal_move_list();
+				else {
+					libchess::Color side = sp.pos.side_to_move();
+					sp.pos.generate_promotions   (move_list, side);
+					sp.pos.generate_capture_moves(move_list, side);
+				}
+				score_moves();
+				stage = S_NOISY;
+				break;
+			case S_NOISY: {
+				auto move = select();
+				if (move.has_value())
+					return move;
+				stage = in_check || !with_quiets ? S_DONE : S_GEN_QUIETS;
+				break;
+			}
+			case S_GEN_QUIETS:
+				sp.pos.generate_quiet_moves(move_list, sp.pos.side_to_move());
+				score_moves();
+				quiets_generated = true;
+				stage = S_QUIETS;
+				break;
+			case S_QUIETS: {
+				auto move = select();
+				if (move.has_value())
+					return move;
+				stage = S_DONE;
+				break;
+			}
+			case S_DONE:
+				return { };
+		}
+	}
+}
+
 bool is_check(libchess::Position & pos)
 {
 	return pos.attackers_to(pos.piece_type_bb(libchess::constants::KING, !pos.side_to_move()).forward_bitscan(), pos.side_to_move());
@@ -151,22 +247,47 @@ bool is_insufficient_material_draw(const libchess::Position & pos)
         return true;
 }
 
-libchess::MoveList gen_qs_moves(libchess::Position & pos)
+// static evaluation through the per-thread cache
+static int cached_evaluate(search_pars_t & sp, const uint64_t hash)
 {
-	libchess::Color side = pos.side_to_move();
+	sp.cs.data.eval_cache_query++;
+	auto cached = sp.ecache->lookup(hash);
+	if (cached.has_value()) {
+		sp.cs.data.eval_cache_hit++;
+		return cached.value();
+	}
 
-	if (pos.checkers_to(side))
-		return pos.pseudo_legal_move_list();
+	int score = 0;
+	if ((sp.cs.data.eval_cache_query & 255) == 0) {  // sample what an evaluation costs
+		auto start = std::chrono::steady_clock::now();
+		score = nnue_evaluate(sp.nnue_eval, sp.pos);
+		sp.cs.data.eval_timed_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		sp.cs.data.eval_timed++;
+	}
+	else {
+		score = nnue_evaluate(sp.nnue_eval, sp.pos);
+	}
+	sp.ecache->store(hash, score);
+
+	return score;
+}
 
-	libchess::MoveList ml;
-	pos.generate_promotions(ml, side);
-	pos.generate_capture_moves(ml, side);
+// before making move (0 for a null move) at sp.ply: the next ply will be a new
+// node
+static void prepare_next_ply(search_pars_t & sp, const libchess::Move move)
+{
+	search_stack_t & cur  = sp.ss[sp.ply    ];
+	search_stack_t & next = sp.ss[sp.ply + 1];
 
-	return ml;
+	cur.move         = move;
+	cur.reduction    = 0;
+	next.static_eval = TT_NO_EVAL;
+	next.null_moves  = cur.null_moves + (move.value() == 0);
 }
 
-int qs(int alpha, const int beta, const int qsdepth, search_pars_t & sp)
+int qs(int alpha, const int beta, search_pars_t & sp)
 {
+	const int qsdepth = sp.ply + 1;  // as csd in search()
 #if defined(ESP32)
 	if (qsdepth > sp.md) {
 		sp.md = qsdepth;
@@ -181,7 +302,7 @@ int qs(int alpha, const int beta, const int qsdepth, search_pars_t & sp)
 		return nnue_evaluate(sp.nnue_eval, sp.pos);
 	}
 #endif
-	if (qsdepth >= 127)
+	if (sp.ply >= max_ply - 1)
 		return nnue_evaluate(sp.nnue_eval, sp.pos);
 
 	sp.cs.data.qnodes++;
@@ -204,7 +325,7 @@ int qs(int alpha, const int beta, const int qsdepth, search_pars_t & sp)
 	// TT //
 	uint64_t       hash        = sp.pos.hash();
 	std::optional<libchess::Move> tt_move;
-	std::optional<tt_entry> te = tti.lookup(hash);
+	std::optional<tt_entry> te = sp.qtt ? sp.qtt->lookup(hash) : tti.lookup(hash, &sp.cs.data.tt_rejected);
 	sp.cs.data.qtt_query++;
 
         if (te.has_value()) {  // TT hit?
@@ -226,12 +347,30 @@ int qs(int alpha, const int beta, const int qsdepth, search_pars_t & sp)
 	}
 	////////
 
-	int  best_score = -32767;
+	int  best_score  = -32767;
+	int  static_eval = TT_NO_EVAL;
 
+	search_stack_t & ss = sp.ss[sp.ply];
 	bool in_check   = sp.pos.in_check();
+	ss.in_check     = in_check;
+
+	// the TT is shared with search(), its move can be a quiet one
+	if (tt_move.has_value() && (sp.pos.is_legal_move(tt_move.value()) == false ||
+		(!in_check && !sp.pos.is_capture_move(tt_move.value()) && !sp.pos.is_promotion_move(tt_move.value()))))
+		tt_move.reset();
 	if (!in_check) {
 		// standing pat
-		best_score = nnue_evaluate(sp.nnue_eval, sp.pos);
+		if (ss.static_eval != TT_NO_EVAL)  // node is searched again
+			static_eval = ss.static_eval;
+		else if (te.has_value() && te.value().eval != TT_NO_EVAL) {
+			static_eval = te.value().eval;
+			sp.cs.data.tt_eval_hit++;
+		}
+		else {
+			static_eval = cached_evaluate(sp, hash);
+		}
+		ss.static_eval = static_eval;
+		best_score = static_eval;
 		if (best_score > alpha && best_score >= beta) {
 			sp.cs.data.n_standing_pat++;
 			return best_score;
@@ -241,41 +380,21 @@ int qs(int alpha, const int beta, const int qsdepth, search_pars_t & sp)
 	}
 
 	int  n_played  = 0;
-	auto move_list = gen_qs_moves(sp.pos);
 	std::optional<libchess::Move> m;
 
-	sort_movelist_compare smc(sp);
-	if (tt_move.has_value())
-		smc.add_first_move(tt_move.value());
-
-	// generate list of scores
-	size_t           n_moves = move_list.size();
-	std::vector<int> move_scores(n_moves);
-	for(size_t i=0; i<n_moves; i++)
-		move_scores[i] = smc.move_evaluater(*(move_list.begin() + i));
-
-	size_t m_idx  = 0;
-	while(m_idx < n_moves) {
-		size_t selected_idx = m_idx;
-		for(size_t i=m_idx; i<n_moves; i++) {
-			if (move_scores[i] > move_scores[selected_idx])
-				selected_idx = i;
-		}
-
-		std::swap(move_scores[selected_idx], move_scores[m_idx]);
-		std::swap(*(move_list.begin() + selected_idx), *(move_list.begin() + m_idx));
-
-		auto & move = *(move_list.begin() + m_idx);
-		m_idx++;
-
-		if (sp.pos.is_legal_generated_move(move) == false)
-			continue;
+	move_picker picker(sp, tt_move, false, in_check);
+	while(auto next_move = picker.next()) {
+		auto & move = next_move.value();
 
 		n_played++;
 
-		auto undo_actions = make_move(sp.nnue_eval, sp.pos, move);
-		int score = -qs(-beta, -alpha, qsdepth + 1, sp);
-		unmake_move(sp.nnue_eval, sp.pos, undo_actions);
+		prepare_next_ply(sp, move);
+		make_move(sp.nnue_eval, sp.pos, move, sp.ecache);
+		sp.ply++;
+		int score = -qs(-beta, -alpha, sp);
+		sp.ply--;
+		sp.cs.data.nnue_updates++;
+		sp.cs.data.nnue_updates_skipped += unmake_move(sp.nnue_eval, sp.pos) == false;
 
 		if (score > best_score) {
 			best_score = score;
@@ -303,7 +422,7 @@ int qs(int alpha, const int beta, const int qsdepth, search_pars_t & sp)
 			sp.cs.win[!sp.pos.side_to_move()]++;
 		}
 		else if (best_score == -32767) {
-			best_score = nnue_evaluate(sp.nnue_eval, sp.pos);
+			best_score = cached_evaluate(sp, hash);
 		}
 	}
 
@@ -321,10 +440,16 @@ int qs(int alpha, const int beta, const int qsdepth, search_pars_t & sp)
 
 		int work_score = eval_to_tt(best_score, qsdepth);
 
-		if (best_score > start_alpha && m.has_value())
-			tti.store(hash, flag, 0, work_score, m.value());
+		if (sp.qtt) {
+			if (best_score > start_alpha && m.has_value())
+				sp.qtt->store(hash, flag, work_score, static_eval, m.value());
+			else
+				sp.qtt->store(hash, flag, work_score, static_eval);
+		}
+		else if (best_score > start_alpha && m.has_value())
+			tti.store(hash, flag, 0, work_score, static_eval, m.value());
 		else
-			tti.store(hash, flag, 0, work_score);
+			tti.store(hash, flag, 0, work_score, static_eval);
 	}
 
 	return best_score;
@@ -343,24 +468,51 @@ void update_history(const search_pars_t & sp, const int index, const int bonus)
 	sp.history[index] += final_value;
 }
 
-int search(int depth, int alpha, const int beta, const int null_move_depth, const int16_t max_depth, libchess::Move *const m, search_pars_t & sp, libchess::MoveList *const pv)
+// the PV of this node: the move followed by the PV of the child node
+static void update_pv(search_pars_t & sp, const libchess::Move move)
 {
+	search_stack_t       & cur   = sp.ss[sp.ply    ];
+	const search_stack_t & child = sp.ss[sp.ply + 1];
+	assert(child.pv_length < max_ply - sp.ply);
+
+	cur.pv[0]     = move;
+	std::copy(child.pv, child.pv + child.pv_length, cur.pv + 1);
+	cur.pv_length = child.pv_length + 1;
+}
+
+// Root: sp.ply 0, PV: full window, NonPV: null window (alpha == beta - 1).
+// search() is instantiated per type so that the checks for it are resolved
+// at compile time.
+typedef enum { NT_ROOT, NT_PV, NT_NONPV } node_type_t;
+
+// the PV ends up in sp.ss[sp.ply].pv (pv_length moves)
+template<node_type_t nt>
+int search(int depth, int alpha, const int beta, libchess::Move *const m, search_pars_t & sp)
+{
+	constexpr bool     is_root_position = nt == NT_ROOT;
+	constexpr bool     is_pv            = nt != NT_NONPV;
+	constexpr auto     child_nt         = is_pv ? NT_PV : NT_NONPV;  // of the first move
+	assert(is_root_position == (sp.ply == 0));
+	assert(is_pv || alpha == beta - 1);
+
+	sp.ss[sp.ply].pv_length = 0;
+
 	if (sp.stop->flag)
 		return 0;
 
-	if (depth == 0) {
-		int score = qs(alpha, beta, max_depth, sp);
-		pv->clear();
-		return score;
-	}
+	if (depth == 0)
+		return qs(alpha, beta, sp);
+
+	if (sp.ply >= max_ply - 1)  // no ply buffers left
+		return nnue_evaluate(sp.nnue_eval, sp.pos);
 
 	sp.cs.data.nodes++;
 
-	const int  csd              = max_depth -  depth + 1;
-	bool       is_root_position = max_depth == depth;
+	search_stack_t & ss = sp.ss[sp.ply];
+
+	const int  csd              = sp.ply + 1;
 
 	if (!is_root_position && (sp.pos.is_repeat() || sp.pos.halfmoves() > 100 || is_insufficient_material_draw(sp.pos))) {
-		pv->clear();
 		if (sp.pos.in_check()) {
 			if (sp.pos.legal_move_list().empty()) {
 				sp.cs.win[!sp.pos.side_to_move()]++;
@@ -374,12 +526,11 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 	}
 
 	const int  start_alpha = alpha;
-	const bool is_pv       = alpha != beta -1;
 
 	// TT //
 	std::optional<libchess::Move> tt_move { };
 	uint64_t       hash        = sp.pos.hash();
-	std::optional<tt_entry> te = tti.lookup(hash);
+	std::optional<tt_entry> te = tti.lookup(hash, &sp.cs.data.tt_rejected);
 	sp.cs.data.tt_query++;
 
         if (te.has_value()) {  // TT hit?
@@ -392,7 +543,7 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 			}
 		}
 
-		if (te.value().depth >= depth && !is_pv) {
+		if (te.value().depth >= depth && !is_pv && !ss.excluded_move.value()) {
 			int score      = te.value().score;
 			int work_score = eval_from_tt(score, csd);
 			auto flag      = te.value().flags;
@@ -404,13 +555,13 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 				sp.cs.data.tt_cutoff++;
 				if (tt_move.has_value()) {
 					*m = tt_move.value();  // move in TT is valid
-					pv->clear();
+					// truncated PV: the rest of it is not known here
+					sp.ss[sp.ply].pv[0]     = *m;
+					sp.ss[sp.ply].pv_length = 1;
 					return work_score;
 				}
-				if (!is_root_position) {
-					pv->clear();
+				if (!is_root_position)
 					return work_score;
-				}
 			}
 		}
 	}
@@ -442,38 +593,49 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 #endif
 
 	////////
-	bool in_check = sp.pos.in_check();
+	bool in_check    = sp.pos.in_check();
+	int  static_eval = TT_NO_EVAL;
+	ss.in_check      = in_check;
 
 	if (!is_root_position && !in_check && depth <= 7 && beta <= max_non_mate) {
 		sp.cs.data.n_static_eval++;
-		int staticeval = nnue_evaluate(sp.nnue_eval, sp.pos);
+		if (ss.static_eval != TT_NO_EVAL)  // node is searched again
+			static_eval = ss.static_eval;
+		else if (te.has_value() && te.value().eval != TT_NO_EVAL) {
+			static_eval = te.value().eval;
+			sp.cs.data.tt_eval_hit++;
+		}
+		else {
+			static_eval = cached_evaluate(sp, hash);
+		}
+		ss.static_eval = static_eval;
 
 		// static null pruning (reverse futility pruning)
-		if (staticeval - depth * 121 > beta) {
+		if (static_eval - depth * 121 > beta) {
 			sp.cs.data.n_static_eval_hit++;
-			pv->clear();
-			return (beta + staticeval) / 2;
+			return (beta + static_eval) / 2;
 		}
 	}
 
 	///// null move
 	int nm_reduce_depth = depth > 6 ? 4 : 3;
-	if (depth >= 2 && !in_check && !is_root_position && null_move_depth < 2) {
+	if (depth >= 2 && !in_check && !is_root_position && ss.null_moves < 2 && !ss.excluded_move.value()) {
 		sp.cs.data.n_null_move++;
 
-		sp.pos.make_null_move();
-		libchess::MoveList ignore_pv;
 		libchess::Move     ignore_move { };
-		int nmscore = -search(std::max(0, depth - nm_reduce_depth), -beta, -beta + 1, null_move_depth + 1, max_depth, &ignore_move, sp, &ignore_pv);
+		prepare_next_ply(sp, ignore_move);
+		sp.pos.make_null_move();
+		sp.ply++;
+		int nmscore = -search<NT_NONPV>(std::max(0, depth - nm_reduce_depth), -beta, -beta + 1, &ignore_move, sp);
+		sp.ply--;
 		sp.pos.unmake_move();
 
                 if (nmscore >= beta) {
-			libchess::MoveList ignore_pv2;
 			libchess::Move     ignore2 { };
-			int verification = search(std::max(0, depth - nm_reduce_depth), beta - 1, beta, null_move_depth, max_depth, &ignore2, sp, &ignore_pv2);
+			int verification = search<NT_NONPV>(std::max(0, depth - nm_reduce_depth), beta - 1, beta, &ignore2, sp);
 			if (verification >= beta) {
 				sp.cs.data.n_null_move_hit++;
-				pv->clear();
+				sp.ss[sp.ply].pv_length = 0;  // was set by the verification search
 				return abs(nmscore) >= max_non_mate ? beta : nmscore;
 			}
                 }
@@ -481,45 +643,28 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 	///////////////
 
 	int                best_score = -32767;
-	libchess::MoveList move_list  = sp.pos.pseudo_legal_move_list();
 
-	sort_movelist_compare smc(sp);
-
-	if (tt_move.has_value())
-		smc.add_first_move(tt_move.value());
+	move_picker picker(sp, tt_move, true, in_check);
 	if (m->value() && sp.pos.is_capture_move(*m))
-		smc.add_first_move(*m);
+		picker.add_first_move(*m);
 
 	int     n_played   = 0;
 	int     lmr_start  = !in_check && depth >= 2 ? 4 : 999;
 
-	// generate list of scores
-	size_t           n_moves = move_list.size();
-	std::vector<int> move_scores(n_moves);
-	for(size_t i=0; i<n_moves; i++)
-		move_scores[i] = smc.move_evaluater(*(move_list.begin() + i));
-
 	std::optional<libchess::Move> beta_cutoff_move;
 	libchess::Move new_move;
 
-	int new_depth_basic = sp.pos.in_check() || n_moves == 1 ? depth : depth -1;
+	// check extension
+	int new_depth_basic = in_check ? depth : depth -1;
 
-	libchess::MoveList child_pv;
-	size_t             m_idx    = 0;
-	while(m_idx < n_moves) {
-		size_t selected_idx = m_idx;
-		for(size_t i=m_idx; i<n_moves; i++) {
-			if (move_scores[i] > move_scores[selected_idx])
-				selected_idx = i;
-		}
+	// the quiet moves tried before a cut-off get a history malus
+	constexpr int                                max_quiets_tried = 64;
+	std::array<libchess::Move, max_quiets_tried> quiets_tried;
+	int                                          n_quiets_tried   = 0;
 
-		std::swap(move_scores[selected_idx], move_scores[m_idx]);
-		std::swap(*(move_list.begin() + selected_idx), *(move_list.begin() + m_idx));
-
-		auto & move = *(move_list.begin() + m_idx);
-		m_idx++;
-
-		if (sp.pos.is_legal_generated_move(move) == false)
+	while(auto next_move = picker.next()) {
+		auto & move = next_move.value();
+		if (move == ss.excluded_move)
 			continue;
 
 		sp.cur_move = move.value();
@@ -527,9 +672,13 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
                 bool is_lmr = false;
                 int  score  = -max_eval;
 
-		auto undo_actions = make_move(sp.nnue_eval, sp.pos, move);
-		if (n_played == 0)
-			score = -search(new_depth_basic, -beta, -alpha, null_move_depth, max_depth, &new_move, sp, &child_pv);
+		prepare_next_ply(sp, move);
+		make_move(sp.nnue_eval, sp.pos, move, sp.ecache);
+		sp.ply++;
+		if (n_played == 0) {
+			ss.reduction = depth - 1 - new_depth_basic;
+			score = -search<child_nt>(new_depth_basic, -beta, -alpha, &new_move, sp);
+		}
 		else {
 			int new_depth = depth - 1;
 
@@ -537,7 +686,7 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 				is_lmr = true;
 				sp.cs.data.n_lmr++;
 
-				if (alpha == beta -1) {
+				if (!is_pv) {
 					int reduction = lmr_reductions[std::min(N_LMR_DEPTH - 1, int(depth))][std::min(N_LMR_MOVES - 1, n_played)];
 					new_depth = std::max(depth - reduction, 0);
 				}
@@ -548,30 +697,34 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 				}
 			}
 
-			score = -search(new_depth, -alpha - 1, -alpha, null_move_depth, max_depth, &new_move, sp, &child_pv);
+			ss.reduction = depth - 1 - new_depth;
+			score = -search<NT_NONPV>(new_depth, -alpha - 1, -alpha, &new_move, sp);
+			ss.reduction = 0;
 
 			if (is_lmr && score > alpha)
-				score = -search(depth -1, -alpha - 1, -alpha, null_move_depth, max_depth, &new_move, sp, &child_pv);
+				score = -search<NT_NONPV>(depth -1, -alpha - 1, -alpha, &new_move, sp);
 
-			if (score > alpha && score < beta)
-				score = -search(depth - 1, -beta, -alpha, null_move_depth, max_depth, &new_move, sp, &child_pv);
+			// in a null window node beta is alpha + 1
+			if (is_pv && score > alpha && score < beta)
+				score = -search<NT_PV>(depth - 1, -beta, -alpha, &new_move, sp);
 		}
-		unmake_move(sp.nnue_eval, sp.pos, undo_actions);
+		sp.ply--;
+		sp.cs.data.nnue_updates++;
+		sp.cs.data.nnue_updates_skipped += unmake_move(sp.nnue_eval, sp.pos) == false;
 
 		n_played++;
 
+		bool is_quiet = !sp.pos.is_capture_move(move);
+
 		if (score > best_score) {
 			best_score         = score;
 			*m                 = move;
 
-			pv->clear();
-			pv->add(move);
-			for(auto & child_pv_move: child_pv)
-				pv->add(child_pv_move);
+			update_pv(sp, move);
 
 			if (score > alpha) {
 				if (score >= beta) {
-					if (!sp.pos.is_capture_move(move))
+					if (is_quiet)
 						beta_cutoff_move = move;
 					sp.cs.data.n_lmr_hit += is_lmr;
 					break;
@@ -580,21 +733,25 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 				alpha = score;
 			}
 		}
+
+		if (is_quiet && n_quiets_tried < max_quiets_tried)
+			quiets_tried[n_quiets_tried++] = move;
+	}
+
+	if (!in_check) {
+		sp.cs.data.quiet_gen++;
+		sp.cs.data.quiet_gen_skipped += picker.generated_quiets() == false;
 	}
 
 	// https://www.chessprogramming.org/History_Heuristic#History_Bonuses
-	if (beta_cutoff_move.has_value() && sp.pos.is_capture_move(beta_cutoff_move.value()) == false) {
-		int bonus = depth * 30 - 25;
-		for(auto move : move_list) {
-			if (sp.pos.is_capture_move(move))
-				continue;
-			auto piece_type_from = sp.pos.piece_type_on(move.from_square());
-			int  index           = history_index(sp.pos.side_to_move(), piece_type_from.value(), move.to_square());
-			if (move == beta_cutoff_move.value()) {
-				update_history(sp, index, bonus);
-				break;
-			}
-			update_history(sp, index, -bonus);
+	if (beta_cutoff_move.has_value()) {
+		int  bonus = depth * 30 - 25;
+		auto side  = sp.pos.side_to_move();
+		auto cutoff_type_from = sp.pos.piece_type_on(beta_cutoff_move.value().from_square());
+		update_history(sp, history_index(side, cutoff_type_from.value(), beta_cutoff_move.value().to_square()), bonus);
+		for(int i=0; i<n_quiets_tried; i++) {
+			auto piece_type_from = sp.pos.piece_type_on(quiets_tried[i].from_square());
+			update_history(sp, history_index(side, piece_type_from.value(), quiets_tried[i].to_square()), -bonus);
 		}
 
 		sp.cs.data.n_moves_cutoff += n_played;
@@ -614,7 +771,7 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 		}
 	}
 
-	if (sp.stop->flag == false) {
+	if (sp.stop->flag == false && !ss.excluded_move.value()) {
 		sp.cs.data.tt_store++;
 
 		tt_entry_flag flag = EXACT;
@@ -626,9 +783,9 @@ int search(int depth, int alpha, const int beta, const int null_move_depth, cons
 		int work_score = eval_to_tt(best_score, csd);
 
 		if (best_score > start_alpha && m->value())
-			tti.store(hash, flag, depth, work_score, *m);
+			tti.store(hash, flag, depth, work_score, static_eval, *m);
 		else
-			tti.store(hash, flag, depth, work_score);
+			tti.store(hash, flag, depth, work_score, static_eval);
 	}
 
 	return best_score;
@@ -657,18 +814,18 @@ double calculate_EBF(const std::vector<uint64_t> & node_counts)
         return n >= 3 ? sqrt(double(node_counts.at(n - 1)) / double(node_counts.at(n - 3))) : -1;
 }
 
-std::string gen_pv_str(const libchess::MoveList & pv)
+std::string gen_pv_str(const pv_t & pv)
 {
 	std::string pv_str;
-	for(int i=0; i<pv.size(); i++) {
+	for(int i=0; i<pv.length; i++) {
 		if (i)
 			pv_str += " ";
-		pv_str += (pv.cbegin() + i)->to_str();
+		pv_str += pv.moves[i].to_str();
 	}
 	return pv_str;
 }
 
-std::string emit_result(const int best_score, const uint64_t thought_ms, const std::vector<uint64_t> & node_counts, const int max_depth, const std::pair<uint64_t, uint64_t> & nodes, const libchess::MoveList & pv, const bool is_tui, const std::optional<uint32_t> & time_left)
+std::string emit_result(const int best_score, const uint64_t thought_ms, const std::vector<uint64_t> & node_counts, const int max_depth, const std::pair<uint64_t, uint64_t> & nodes, const pv_t & pv, const bool is_tui, const std::optional<uint32_t> & time_left)
 {
 	std::string pv_str     = gen_pv_str(pv);
 	double      ebf        = calculate_EBF(node_counts);
@@ -731,6 +888,8 @@ std::tuple<libchess::Move, int, int> search_it(const int search_time_min, const
 #endif
 
 	if (sp->thread_nr == 0) {
+		tti.inc_generation();
+
 		if (search_time_max > 0) {
 #if defined(linux) || defined(_WIN32) || defined(__ANDROID__) || defined(__APPLE__)
 			think_timeout_timer = new std::thread([search_time_min, search_time_max, sp] {
@@ -771,8 +930,16 @@ std::tuple<libchess::Move, int, int> search_it(const int search_time_min, const
 			sp->md = 0;
 			if (max_depth >= 4)
 				cur_move = sp->best_moves[max_depth - 3];
-			libchess::MoveList pv;
-			int                score = search(max_depth, alpha, beta, 0, max_depth, &cur_move, *sp, &pv);
+			sp->ply = 0;
+			sp->ss[0].static_eval = TT_NO_EVAL;
+			sp->ss[0].null_moves  = 0;
+#if defined(ALLOC_COUNT)
+			alloc_counting = max_depth > 1;  // lazy initialisations are allowed in the first one
+#endif
+			int                score = search<NT_ROOT>(max_depth, alpha, beta, &cur_move, *sp);
+#if defined(ALLOC_COUNT)
+			alloc_counting = false;
+#endif
 			assert(score >= -max_eval && score <= max_eval);
 
 			auto counts = simple_search_statistics();
@@ -780,8 +947,7 @@ std::tuple<libchess::Move, int, int> search_it(const int search_time_min, const
 				if (sp->thread_nr == 0 && output >= O_MINIMAL) {
 					my_trace("info string stop flag set\n");
 					uint64_t thought_ms = (esp_timer_get_time() - t_offset) / 1000;
-					libchess::MoveList l_pv;
-					l_pv.add(best_move);
+					pv_t l_pv { &best_move, 1 };
 					auto temp = emit_result(best_score, thought_ms, node_counts, max_depth, counts, l_pv, is_tui, search_time_max - thought_ms);
 					if (output == O_FULL)
 						emit(temp, is_tui);
@@ -850,7 +1016,7 @@ std::tuple<libchess::Move, int, int> search_it(const int search_time_min, const
 				uint64_t thought_ms = (esp_timer_get_time() - t_offset) / 1000;
 
 				if (sp->thread_nr == 0 && output >= O_MINIMAL) {
-					auto temp = emit_result(best_score, thought_ms, node_counts, max_depth, counts, pv, is_tui, search_time_max - thought_ms);
+					auto temp = emit_result(best_score, thought_ms, node_counts, max_depth, counts, { sp->ss[0].pv, sp->ss[0].pv_length }, is_tui, search_time_max - thought_ms);
 					if (output == O_FULL)
 						emit(temp, is_tui);
 					else
@@ -885,8 +1051,7 @@ std::tuple<libchess::Move, int, int> search_it(const int search_time_min, const
 	}
 	else {
 		my_trace("info string only 1 move possible (%s for %s)\n", best_move.to_str().c_str(), sp->pos.fen().c_str());
-		libchess::MoveList pv;
-		pv.add(best_move);
+		pv_t pv { &best_move, 1 };
 		best_score = nnue_evaluate(sp->nnue_eval, sp->pos);
 
 		auto temp = emit_result(best_score, 0, { }, 0, { 0, 0 }, pv, is_tui, search_time_max);
@@ -1,3 +1,4 @@
+#include <array>
 #include <cstdint>
 #include <optional>
 #include <libchess/Position.h>
@@ -21,10 +22,47 @@ public:
 
 void sort_movelist(libchess::MoveList & move_list, const sort_movelist_compare & smc);
 
+// Returns the moves of a position one by one, best first, generating them
+// in stages: the TT move (no generation at all), then promotions and
+// captures and only then the quiet moves (not in qs). Most nodes cut off
+// before the last stage. In check all evasions are generated at once.
+// Only legal moves are returned. Uses the ply buffers of sp.ply, so one
+// picker per ply.
+class move_picker
+{
+private:
+	enum stage_t { S_TT, S_GEN_NOISY, S_NOISY, S_GEN_QUIETS, S_QUIETS, S_DONE };
+
+	search_pars_t               & sp;
+	sort_movelist_compare         smc;
+	stage_t                       stage { S_TT };
+	const bool                    with_quiets;
+	const bool                    in_check;
+	std::optional<libchess::Move> tt_move;
+	libchess::MoveList            move_list;
+	std::array<int, max_moves>  & move_scores;  // in sp.ss[sp.ply]
+	int                           m_idx   { 0 };
+	bool                          quiets_generated { false };
+
+	void score_moves();
+	std::optional<libchess::Move> select();
+
+public:
+	// tt_move must be legal (if set)
+	move_picker(search_pars_t & sp, const std::optional<libchess::Move> & tt_move, const bool with_quiets, const bool in_check);
+
+	// moved (directly) after the TT move when it is generated
+	void add_first_move(const libchess::Move move);
+
+	std::optional<libchess::Move> next();
+
+	bool generated_quiets() const { return quiets_generated; }
+};
+
 bool is_insufficient_material_draw(const libchess::Position & pos);
 
 typedef enum { O_NONE, O_MINIMAL, O_FULL } output_type_t;
 std::tuple<libchess::Move, int, int> search_it(const int search_time_min, const int search_time_max, const bool is_absolute_time, search_pars_t *const sp, const int ultimate_max_depth, std::optional<uint64_t> max_n_nodes, const output_type_t output, const bool is_tui);
 
 std::optional<libchess::Move> str_to_move(const libchess::Position & p, const std::string & m);
-std::string emit_result(const int best_score, const uint64_t thought_ms, const std::vector<uint64_t> & node_counts, const int max_depth, const std::pair<uint64_t, uint64_t> & nodes, const libchess::MoveList & pv, const bool is_tui, const std::optional<uint32_t> & time_left);
+std::string emit_result(const int best_score, const uint64_t thought_ms, const std::vector<uint64_t> & node_counts, const int max_depth, const std::pair<uint64_t, uint64_t> & nodes, const pv_t & pv, const bool is_tui, const std::optional<uint32_t> & time_left);
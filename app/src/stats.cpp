@@ -38,6 +38,8 @@ void chess_stats::add(const chess_stats & source)
         this->data.tt_store   += source.data.tt_store;
         this->data.tt_cutoff  += source.data.tt_cutoff;
         this->data.tt_invalid += source.data.tt_invalid;
+        this->data.tt_rejected += source.data.tt_rejected;
+        this->data.tt_eval_hit += source.data.tt_eval_hit;
 
 	this->data.qtt_query  += source.data.qtt_query;
 	this->data.qtt_hit    += source.data.qtt_hit;
@@ -53,6 +55,17 @@ void chess_stats::add(const chess_stats & source)
 	this->data.n_static_eval     += source.data.n_static_eval;
 	this->data.n_static_eval_hit += source.data.n_static_eval_hit;
 
+	this->data.nnue_updates         += source.data.nnue_updates;
+	this->data.nnue_updates_skipped += source.data.nnue_updates_skipped;
+
+	this->data.eval_cache_query += source.data.eval_cache_query;
+	this->data.eval_cache_hit   += source.data.eval_cache_hit;
+	this->data.eval_timed       += source.data.eval_timed;
+	this->data.eval_timed_ns    += source.data.eval_timed_ns;
+
+	this->data.quiet_gen         += source.data.quiet_gen;
+	this->data.quiet_gen_skipped += source.data.quiet_gen_skipped;
+
 	this->data.n_moves_cutoff  += source.data.n_moves_cutoff;
 	this->data.nmc_nodes       += source.data.nmc_nodes;
 	this->data.n_qmoves_cutoff += source.data.n_qmoves_cutoff;
@@ -23,7 +23,9 @@ public:
 		uint32_t  tt_hit;
 		uint32_t  tt_store;
 		uint32_t  tt_invalid;
+		uint32_t  tt_rejected;
 		uint32_t  tt_cutoff;
+		uint32_t  tt_eval_hit;  // static evaluations taken from the TT instead of computed
 		uint32_t  qtt_query;
 		uint32_t  qtt_hit;
 		uint32_t  qtt_store;
@@ -38,6 +40,17 @@ public:
 		uint32_t  n_static_eval;
 		uint32_t  n_static_eval_hit;
 
+		uint64_t  nnue_updates;          // moves made
+		uint64_t  nnue_updates_skipped;  // ...of which the accumulators were never computed
+
+		uint64_t  eval_cache_query;
+		uint64_t  eval_cache_hit;
+		uint64_t  eval_timed;     // every 256th evaluation that missed the cache is timed...
+		uint64_t  eval_timed_ns;  // ...to estimate what the hits saved
+
+		uint64_t  quiet_gen;          // search() nodes (not in check) that could need the quiet moves...
+		uint64_t  quiet_gen_skipped;  // ...but were done before generating them
+
 		uint64_t  n_moves_cutoff;
 		uint64_t  nmc_nodes;
 		uint64_t  n_qmoves_cutoff;
@@ -1,4 +1,6 @@
 #include <cinttypes>
+#include <memory>
+#include <set>
 #include <thread>
 
 #include <libchess/Position.h>
@@ -18,13 +20,14 @@
 		exit(1); \
 	}
 
-int get_nnue_score(libchess::Position &pos)
+// from-scratch evaluation, reusing one Eval instead of allocating a new one per position
+int get_nnue_score(Eval *const scratch, libchess::Position &pos)
 {
-	Eval e(pos);
-	return nnue_evaluate(&e, pos);
+	scratch->set(pos);
+	return nnue_evaluate(scratch, pos);
 }
 
-uint64_t do_nnue_verify_perft(Eval *const nnue_eval, libchess::Position &pos, int depth, const int max_depth)
+uint64_t do_nnue_verify_perft(Eval *const nnue_eval, Eval *const scratch, libchess::Position &pos, int depth, const int max_depth)
 {
         libchess::MoveList move_list = pos.legal_move_list();
         if (depth == 1)
@@ -32,21 +35,19 @@ uint64_t do_nnue_verify_perft(Eval *const nnue_eval, libchess::Position &pos, in
 
         uint64_t count = 0;
         for(const libchess::Move & move: move_list) {
-		auto undo_actions = make_move(nnue_eval, pos, move);
-                count += do_nnue_verify_perft(nnue_eval, pos, depth - 1, max_depth);
-		unmake_move(nnue_eval, pos, undo_actions);
+		make_move(nnue_eval, pos, move);
 
+		// the incrementally updated accumulators must match a from-scratch (and a scalar) evaluation
 		{
-			int a = 0, b = 0;
-			if ((a = get_nnue_score(pos)) != (b = nnue_evaluate(nnue_eval, pos))) {
-				printf("fail @ %d: %s %s (%d != %d)\n", depth, pos.fen().c_str(), move.to_str().c_str(), a, b);
-				for(int i=0; i<undo_actions.first; i++) {
-					auto & action = undo_actions.second[i];
-					printf("%s: %s %c %s\n", action.is_put ? "ADD":"REM", action.location.to_str().c_str(), action.type.to_char(), action.is_white ? "white":"black");
-				}
+			int a = 0, b = 0, c = 0;
+			if ((a = get_nnue_score(scratch, pos)) != (b = nnue_evaluate(nnue_eval, pos)) || (c = nnue_evaluate_reference(pos)) != b) {
+				printf("fail @ %d: %s %s (%d != %d, scalar: %d)\n", depth, pos.fen().c_str(), move.to_str().c_str(), a, b, c);
 				my_assert(false);
 			}
 		}
+
+                count += do_nnue_verify_perft(nnue_eval, scratch, pos, depth - 1, max_depth);
+		unmake_move(nnue_eval, pos);
         }
 
         return count;
@@ -55,8 +56,9 @@ uint64_t do_nnue_verify_perft(Eval *const nnue_eval, libchess::Position &pos, in
 void nnue_verify_perft(Eval *const nnue_eval, libchess::Position &pos, const std::vector<unsigned> & depths)
 {
 	nnue_eval->set(pos);
+	std::unique_ptr<Eval> scratch(Eval::create(pos));
 	for(size_t i=0; i<depths.size(); i++) {
-		uint64_t result = do_nnue_verify_perft(nnue_eval, pos, i + 1, i + 1);
+		uint64_t result = do_nnue_verify_perft(nnue_eval, scratch.get(), pos, i + 1, i + 1);
 		if (result != depths.at(i)) {
 			printf("Count mismatch, got %" PRIu64 ", expected %u\n", result, depths.at(i));
 			my_assert(false);
@@ -86,6 +88,25 @@ void tests()
 		printf("OK\n");
 	}
 
+	{
+		printf("predicted hash test\n");
+		for(auto & fen: { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", "3k4/8/8/2PBb3/4p3/2K1N3/8/8 b - -" }) {
+			Position pos { fen };
+			int n_predicted = 0;
+			for(auto & move: pos.legal_move_list()) {
+				auto hash = predict_hash(pos, move);
+				pos.make_move(move);
+				if (hash.has_value()) {
+					my_assert(hash.value() == pos.hash());
+					n_predicted++;
+				}
+				pos.unmake_move();
+			}
+			my_assert(n_predicted > 0);
+		}
+		printf("OK\n");
+	}
+
 	{
 		printf("NNUE perft\n");
 
@@ -103,7 +124,7 @@ void tests()
 		for(auto & record: perfts) {
 			printf("Testing %s\n", record.first.c_str());
 			Position pos { record.first };
-			Eval *e = new Eval(pos);
+			Eval *e = Eval::create(pos);
 			nnue_verify_perft(e, pos, record.second);
 			delete e;
 		}
@@ -121,23 +142,23 @@ void tests()
 		// depth 1
 		{
 			for(auto & move: sp.at(0)->pos.legal_move_list()) {
-				auto undo_actions = make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, move);
+				make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, move);
 				my_assert(sp.at(0)->pos.fen() != before_str);
-				unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos, undo_actions);
+				unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 				my_assert(before == nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos));
 			}
 		}
 
 		// depth 2
 		{
-			auto undo_actions1 = make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::D2, constants::D4, Move::Type::DOUBLE_PUSH });
+			make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::D2, constants::D4, Move::Type::DOUBLE_PUSH });
 			std::string before_str2 = sp.at(0)->pos.fen();
 			for(auto & move: sp.at(0)->pos.legal_move_list()) {
-				auto undo_actions2 = make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, move);
+				make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, move);
 				my_assert(sp.at(0)->pos.fen() != before_str2);
-				unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos, undo_actions2);
+				unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			}
-			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos, undo_actions1);
+			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			my_assert(before == nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos));
 		}
 
@@ -146,12 +167,12 @@ void tests()
 			sp.at(0)->pos = Position("8/5P1k/8/4B1K1/8/1B6/2N5/8 w - - 0 1");
 			init_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			int before2 = nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos);
-			auto undo_actions1 = make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::E5, constants::B8, Move::Type::NORMAL });
+			make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::E5, constants::B8, Move::Type::NORMAL });
 			my_assert(sp.at(0)->pos.fen() != before_str);
-			auto undo_actions2 = make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::F7, constants::F8, constants::ROOK, Move::Type::PROMOTION });
+			make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::F7, constants::F8, constants::ROOK, Move::Type::PROMOTION });
 			my_assert(sp.at(0)->pos.fen() != before_str);
-			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos, undo_actions2);
-			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos, undo_actions1);
+			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
+			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			my_assert(before2 == nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos));
 		}
 
@@ -160,9 +181,9 @@ void tests()
 			sp.at(0)->pos = Position("4b3/5P1k/8/6K1/8/1B6/2N5/8 w - - 0 1");
 			init_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			int before2 = nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos);
-			auto undo_actions1 = make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::F7, constants::E8, constants::ROOK, Move::Type::CAPTURE_PROMOTION });
+			make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::F7, constants::E8, constants::ROOK, Move::Type::CAPTURE_PROMOTION });
 			my_assert(sp.at(0)->pos.fen() != before_str);
-			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos, undo_actions1);
+			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			my_assert(before2 == nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos));
 		}
 
@@ -171,9 +192,9 @@ void tests()
 			sp.at(0)->pos = Position("rnbqkbnr/p1p1p1pp/1p1p1p2/8/4P3/3B3N/PPPP1PPP/RNBQK2R w KQkq - 0 4");
 			init_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			int before2 = nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos);
-			auto undo_actions1 = make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::E1, constants::G1, Move::Type::CASTLING });
+			make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::E1, constants::G1, Move::Type::CASTLING });
 			my_assert(sp.at(0)->pos.fen() != before_str);
-			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos, undo_actions1);
+			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			my_assert(before2 == nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos));
 		}
 
@@ -182,12 +203,12 @@ void tests()
 			sp.at(0)->pos = Position("rnbqkbnr/p1ppp1pp/1p3p2/4P3/8/3B3N/PPPP1PPP/RNBQK2R b KQkq - 0 1");
 			init_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			int before2 = nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos);
-			auto undo_actions1 = make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::D7, constants::D5, Move::Type::NORMAL });
+			make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::D7, constants::D5, Move::Type::NORMAL });
 			my_assert(sp.at(0)->pos.fen() != before_str);
-			auto undo_actions2 = make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::E5, constants::D6, Move::Type::ENPASSANT });
+			make_move(sp.at(0)->nnue_eval, sp.at(0)->pos, { constants::E5, constants::D6, Move::Type::ENPASSANT });
 			my_assert(sp.at(0)->pos.fen() != before_str);
-			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos, undo_actions2);
-			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos, undo_actions1);
+			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
+			unmake_move(sp.at(0)->nnue_eval, sp.at(0)->pos);
 			my_assert(before2 == nnue_evaluate(sp.at(0)->nnue_eval, sp.at(0)->pos));
 		}
 
@@ -239,6 +260,34 @@ void tests()
 		printf("OK\n");
 	}
 
+	// - PV (the triangular PV table)
+	{
+		printf("PV test\n");
+		sp.at(0)->pos = Position { "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3" };
+		std::string fen = sp.at(0)->pos.fen();
+
+		clear_flag(sp.at(0)->stop);
+		memset(sp.at(0)->history, 0x00, history_malloc_size);
+		Move best_move  { 0 };
+		int  best_score { 0 };
+		int  max_depth  { 0 };
+		std::tie(best_move, best_score, max_depth) = search_it(0, 0, false, sp.at(0), 6, { }, O_NONE, false);
+
+		pv_t pv { sp.at(0)->ss[0].pv, sp.at(0)->ss[0].pv_length };
+		my_assert(pv.length >= 1);
+		my_assert(pv.moves[0] == best_move);
+
+		// must be playable from the root position
+		Position work { fen };
+		for(int i=0; i<pv.length; i++) {
+			my_assert(work.is_legal_move(pv.moves[i]));
+			work.make_move(pv.moves[i]);
+		}
+		my_assert(sp.at(0)->pos.fen() == fen);
+
+		printf("OK\n");
+	}
+
 	// - move sorting & generation
 	{
 		printf("move sorting & generation test\n");
@@ -262,6 +311,40 @@ void tests()
 		printf("OK\n");
 	}
 
+	// - staged move picker: all legal moves, each once, TT move first, captures before quiets
+	{
+		printf("move picker test\n");
+
+		for(auto & fen: { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+				  "rnbqkbnr/2p1p1pp/1p3p2/p2p4/Q1P1P3/8/PP1P1PPP/RNB1KBNR b KQkq - 0 1",
+				  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1" }) {
+			sp.at(0)->pos = Position { fen };
+			MoveList legal = sp.at(0)->pos.legal_move_list();
+			Move     tt    = *(legal.begin() + legal.size() - 1);
+
+			for(bool with_tt: { false, true }) {
+				move_picker picker(*sp.at(0), with_tt ? std::optional<Move>(tt) : std::optional<Move>(), true, sp.at(0)->pos.in_check());
+				std::set<uint32_t> seen;
+				bool quiet_seen = false;
+				while(auto move = picker.next()) {
+					if (with_tt && seen.empty()) {
+						my_assert(move.value() == tt);
+					}
+					else if (sp.at(0)->pos.is_capture_move(move.value()) || sp.at(0)->pos.is_promotion_move(move.value())) {
+						my_assert(quiet_seen == false || sp.at(0)->pos.in_check());
+					}
+					else {
+						quiet_seen = true;
+					}
+					my_assert(seen.insert(move.value().value()).second);
+				}
+				my_assert(seen.size() == size_t(legal.size()));
+			}
+		}
+
+		printf("OK\n");
+	}
+
 	// tt
 	{
 		printf("tt test\n");
@@ -269,11 +352,11 @@ void tests()
 		tti.reset();
 		// initial state
 		my_assert(tti.lookup(1).has_value() == false);
-		my_assert(tti.lookup(0).has_value() == true);
+		my_assert(tti.lookup(0).has_value() == false);
 
 		// just set a record
 		{
-			tti.store(2, EXACT, 3, 4, *Move::from("e2e4"));
+			tti.store(2, EXACT, 3, 4, 11, *Move::from("e2e4"));
 			my_assert(tti.lookup(0).has_value() == false);
 			my_assert(tti.lookup(1).has_value() == false);
 			my_assert(tti.lookup(2).has_value() == true);
@@ -285,6 +368,173 @@ void tests()
 			my_assert(data1.depth == 3);
 			my_assert(data1.score == 4);
 			my_assert(data1.flags == EXACT);
+			my_assert(data1.eval == 11);
+		}
+
+		// a shallow store must not evict a deep entry in the same cluster
+		{
+			tti.store(2, LOWERBOUND, 0, 5, TT_NO_EVAL);
+			auto record2 = tti.lookup(2);
+			my_assert(record2.has_value());
+			my_assert(record2.value().depth == 3);
+
+			for(int i=0; i<N_TT_CLUSTER_ENTRIES; i++)
+				tti.store(3 + i, UPPERBOUND, 0, 6, TT_NO_EVAL);
+			my_assert(tti.lookup(2).has_value() == true);
+		}
+
+		// after a new game, old entries are only usable for move ordering
+		{
+			tti.new_game();
+			auto record3 = tti.lookup(2);
+			my_assert(record3.has_value());
+			my_assert(record3.value().flags == NOTVALID);
+			my_assert(Move(uint_to_libchessmove(record3.value().M)) == *Move::from("e2e4"));
+			my_assert(tti.get_per_mille_filled() == 0);
+
+			tti.store(2, UPPERBOUND, 1, 7, TT_NO_EVAL);
+			auto record4 = tti.lookup(2);
+			my_assert(record4.has_value());
+			my_assert(record4.value().flags == UPPERBOUND);
+			my_assert(record4.value().depth == 1);
+			my_assert(record4.value().eval == 11);  // the static eval stays valid across games
+		}
+
+		// thread-local qs cache
+		{
+			qs_tt q(4096);
+			my_assert(q.lookup(2).has_value() == false);
+			q.store(2, LOWERBOUND, 8, 9, *Move::from("e2e4"));
+			q.store(2, UPPERBOUND, 10, TT_NO_EVAL);
+			auto record6 = q.lookup(2);
+			my_assert(record6.has_value());
+			my_assert(record6.value().flags == UPPERBOUND);
+			my_assert(record6.value().score == 10);
+			my_assert(record6.value().eval == 9);
+			my_assert(Move(uint_to_libchessmove(record6.value().M)) == *Move::from("e2e4"));
+			q.reset();
+			my_assert(q.lookup(2).has_value() == false);
+		}
+
+		// evaluation cache
+		{
+			eval_cache ec(4096);
+			my_assert(ec.lookup(0x123456789abcdef0ull).has_value() == false);
+			ec.store(0x123456789abcdef0ull, -1234);
+			my_assert(ec.lookup(0x123456789abcdef0ull).value() == -1234);
+			my_assert(ec.lookup(0x923456789abcdef0ull).has_value() == false);  // same slot, other position
+			ec.store(0x923456789abcdef0ull, 55);
+			my_assert(ec.lookup(0x923456789abcdef0ull).value() == 55);
+			my_assert(ec.lookup(0x123456789abcdef0ull).has_value() == false);
+			ec.reset();
+			my_assert(ec.lookup(0x923456789abcdef0ull).has_value() == false);
+		}
+
+#if defined(linux)
+		// a saved table comes back as-is, but only for the same network
+		{
+			const char *const file = "dog-tt-test.dat";
+			my_assert(tti.save(file, 123));
+			tti.reset();
+			my_assert(tti.load(file, 124) == false);
+			my_assert(tti.lookup(2).has_value() == false);
+			my_assert(tti.load(file, 123));
+			auto record5 = tti.lookup(2);
+			my_assert(record5.has_value());
+			my_assert(record5.value().flags == UPPERBOUND);
+			my_assert(record5.value().depth == 1);
+			remove(file);
+		}
+#endif
+
+		// more searches than there are generations: ages that may have wrapped count as old
+		// (in a cluster of its own: h + i with i < 8 all map to the middle one)
+		{
+			const uint64_t h = (1ull << 63) | (1ull << 31);
+
+			tti.new_game();
+			tti.store(h, EXACT, 3, 8, TT_NO_EVAL);
+			tti.new_game();
+			for(int i=0; i<20; i++)
+				tti.inc_generation();
+			auto record7 = tti.lookup(h);
+			my_assert(record7.has_value());
+			my_assert(record7.value().flags == NOTVALID);
+
+			// a long game: entries of its earlier searches are still valid...
+			tti.store(h, EXACT, 30, 8, TT_NO_EVAL);
+			for(int i=0; i<15; i++)
+				tti.inc_generation();
+			auto record8 = tti.lookup(h);
+			my_assert(record8.has_value());
+			my_assert(record8.value().flags == EXACT);
+
+			// ...but not once their age saturates, and then they are the first to be replaced
+			for(int i=1; i<N_TT_CLUSTER_ENTRIES; i++)
+				tti.store(h + i, EXACT, 20, 9, TT_NO_EVAL);
+			for(int i=0; i<2; i++)
+				tti.inc_generation();
+			my_assert(tti.lookup(h).value().flags == NOTVALID);
+			my_assert(tti.lookup(h + 1).value().flags == EXACT);
+
+			tti.store(h + 7, UPPERBOUND, 0, 10, TT_NO_EVAL);
+			my_assert(tti.lookup(h + 7).has_value());
+			my_assert(tti.lookup(h).has_value() == false);
+			for(int i=1; i<N_TT_CLUSTER_ENTRIES; i++) {
+				my_assert(tti.lookup(h + i).value().depth == 20);
+			}
+
+			// an entry of a previous search is not protected against a shallow store
+			tti.store(h + 1, LOWERBOUND, 0, 11, TT_NO_EVAL);
+			my_assert(tti.lookup(h + 1).value().depth == 0);
+		}
+
+#if !defined(ESP32)  // there the old table is freed before the new one is allocated
+		// resizing keeps the entries, both when growing and when shrinking the table
+		{
+			const uint64_t old_size = tti.get_size();
+			const tt_entry_flag flags[] { EXACT, LOWERBOUND, UPPERBOUND };
+			const char *const moves[] { "e2e4", "g1f3", "d7d5", "b8c6" };
+			constexpr const int n = 64;
+			auto hash_of = [](const int i) { return (i + 1) * 0x9e3779b97f4a7c15ull; };  // spread over the clusters
+
+			tti.new_game();
+			for(int i=0; i<n; i++)
+				tti.store(hash_of(i), flags[i % 3], 1 + i % 100, i * 3 - 100, i, *Move::from(moves[i % 4]));
+
+			for(uint64_t size: { old_size * 2, old_size / 4 }) {
+				tti.set_size(size);
+				my_assert(tti.get_size() == size);
+
+				for(int i=0; i<n; i++) {
+					auto record = tti.lookup(hash_of(i));
+					my_assert(record.has_value());
+					my_assert(record.value().flags == flags[i % 3]);
+					my_assert(record.value().depth == 1 + i % 100);
+					my_assert(record.value().score == i * 3 - 100);
+					my_assert(record.value().eval == i);
+					my_assert(Move(uint_to_libchessmove(record.value().M)) == *Move::from(moves[i % 4]));
+				}
+			}
+
+			tti.set_size(old_size);
+		}
+#endif
+
+		// a slot whose key and data come from two different stores is not used, but counted
+		{
+			const uint64_t h = (1ull << 62) | (1ull << 30);
+
+			tti.store(h, EXACT, 5, 100, 42, *Move::from("e2e4"));
+			tt_entry other = tti.lookup(h).value();
+			other.score = -100;
+			other.depth = 7;
+			other.flags = LOWERBOUND;
+			my_assert(tti.debug_tear(h, other));
+
+			uint32_t n_rejected = 0;
+			my_assert(tti.lookup(h, &n_rejected).has_value() == false);
+			my_assert(n_rejected == 1);
 		}
 
 		printf("OK\n");
@@ -425,12 +675,135 @@ void tests()
 		for(auto & test: san_parsing_tests) {
 			libchess::Position pos(std::get<0>(test));
 			init_move(sp.at(0)->nnue_eval, pos);
+#if defined(NNUE_INT8)
+			// the expected scores are those of the int16 network
+			my_assert(nnue_evaluate(sp.at(0)->nnue_eval, pos) == nnue_evaluate_reference(pos));
+#else
 			my_assert(nnue_evaluate(sp.at(0)->nnue_eval, pos) == std::get<3>(test));
+#endif
+		}
+
+		printf("OK\n");
+	}
+
+	// every NNUE kernel set this CPU can run gives the same evaluations
+	{
+		printf("NNUE kernels test\n");
+
+		for(auto & kernels: { "generic", "avx2", "avx512" }) {
+			if (nnue_select_kernels(kernels) == false)
+				continue;
+
+			for(auto & test: san_parsing_tests) {
+				libchess::Position pos(std::get<0>(test));
+				init_move(sp.at(0)->nnue_eval, pos);
+				my_assert(nnue_evaluate(sp.at(0)->nnue_eval, pos) == nnue_evaluate_reference(pos));
+			}
 		}
 
+		my_assert(nnue_select_kernels("auto"));
+
 		printf("OK\n");
 	}
 
+#if defined(linux)
+	// NNUE network from a file
+	{
+		printf("NNUE network loading test\n");
+
+		const char *const file = "dog-nnue-test.bin";
+		const uint64_t embedded_hash = get_network_hash();
+
+		FILE *fh = fopen(file, "wb");
+		fputs("not a network", fh);
+		fclose(fh);
+		my_assert(nnue_load_network(file) == false);
+		my_assert(nnue_load_network("/non/existing/file") == false);
+		my_assert(get_network_hash() == embedded_hash);
+
+		// a network of all zeros evaluates everything as equal
+		fh = fopen(file, "wb");
+		for(int i=0; i<get_network_size(); i++)
+			fputc(0, fh);
+		fclose(fh);
+		my_assert(nnue_load_network(file));
+		my_assert(get_network_hash() != embedded_hash);
+		libchess::Position pos(std::get<0>(san_parsing_tests.at(0)));
+		init_move(sp.at(0)->nnue_eval, pos);
+		my_assert(nnue_evaluate(sp.at(0)->nnue_eval, pos) == 0);
+
+		// other hidden layer sizes need their own Eval
+		fh = fopen(file, "wb");
+		for(int i=0; i<get_network_size(512); i++)
+			fputc(0, fh);
+		fclose(fh);
+		my_assert(nnue_load_network(file));
+		my_assert(get_network_hidden_size() == 512);
+		{
+			std::unique_ptr<Eval> e(Eval::create(pos));
+			my_assert(nnue_evaluate(e.get(), pos) == 0);
+			my_assert(nnue_evaluate_reference(pos) == 0);
+		}
+
+		// king buckets: the refreshes on king moves must match a from-scratch evaluation
+		fh = fopen(file, "wb");
+		uint32_t seed = 1;
+		for(int i=0; i<get_network_size(128, 4) / 2; i++) {
+			seed = seed * 1103515245 + 12345;
+			int16_t v = int16_t((seed >> 16) % 128) - 64;
+			fwrite(&v, sizeof v, 1, fh);
+		}
+		fclose(fh);
+		my_assert(nnue_load_network(file));
+		my_assert(get_network_king_buckets() == 4);
+		{
+			Position pos { "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1" };
+			std::unique_ptr<Eval> e(Eval::create(pos));
+			nnue_verify_perft(e.get(), pos, { 26, 568, 13744 });
+		}
+
+		// lazy accumulators: several moves without an evaluation in between,
+		// both kings changing bucket (a refresh) followed by two captures
+		{
+			Position pos { "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1" };
+			std::unique_ptr<Eval> e(Eval::create(pos));
+			std::unique_ptr<Eval> scratch(Eval::create(pos));
+			const char *const line[] { "Ke2", "Kd7", "Rxa8", "Rxh1" };
+			e->set(pos);
+
+			make_move(e.get(), pos, SAN_to_move(line[0], pos).value());
+			my_assert(nnue_evaluate(e.get(), pos) == get_nnue_score(scratch.get(), pos));
+
+			// popped without ever being computed, back to the materialised first ply
+			for(int i=1; i<4; i++)
+				make_move(e.get(), pos, SAN_to_move(line[i], pos).value());
+			for(int i=1; i<4; i++)
+				unmake_move(e.get(), pos);
+			my_assert(nnue_evaluate(e.get(), pos) == get_nnue_score(scratch.get(), pos));
+
+			for(int i=1; i<4; i++)
+				make_move(e.get(), pos, SAN_to_move(line[i], pos).value());
+			my_assert(nnue_evaluate(e.get(), pos) == get_nnue_score(scratch.get(), pos));
+			my_assert(nnue_evaluate(e.get(), pos) == nnue_evaluate_reference(pos));
+
+			for(int i=0; i<4; i++) {
+				unmake_move(e.get(), pos);
+				my_assert(nnue_evaluate(e.get(), pos) == get_nnue_score(scratch.get(), pos));
+			}
+		}
+
+		my_assert(nnue_load_network("<embedded>"));
+		my_assert(get_network_hidden_size() == HIDDEN_SIZE);
+		my_assert(get_network_hash() == embedded_hash);
+		init_move(sp.at(0)->nnue_eval, pos);
+		my_assert(nnue_evaluate(sp.at(0)->nnue_eval, pos) == nnue_evaluate_reference(pos));
+
+		remove(file);
+
+		printf("OK\n");
+	}
+#endif
+
 	delete_threads();
 }
 
@@ -1,4 +1,5 @@
 #include <cinttypes>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 #if !defined(NDEBUG)
@@ -7,7 +8,13 @@
 #endif
 #endif
 #if defined(linux)
+#include <dirent.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #endif
 
 #if defined(ESP32)
@@ -20,9 +27,61 @@
 
 
 static_assert(sizeof(tt_entry) == 8, "tt_entry must be 8 bytes in size");
+static_assert(sizeof(tt_slot) == 16, "tt_slot must be 16 bytes in size");
+static_assert(sizeof(tt_cluster) == 64, "tt_cluster must be 64 bytes (one cache line) in size");
 
 tt tti;
 
+static inline uint64_t entry_to_word(const tt_entry & e)
+{
+	uint64_t w = 0;
+	memcpy(&w, &e, sizeof w);
+	return w;
+}
+
+static inline tt_entry word_to_entry(const uint64_t w)
+{
+	tt_entry e { };
+	memcpy(&e, &w, sizeof e);
+	return e;
+}
+
+// see https://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/
+#if defined(ESP32)
+static inline uint32_t fastrange32(uint32_t word, uint32_t p)
+{
+	return (uint64_t(word) * uint64_t(p)) >> 32;
+}
+#define fastrange fastrange32
+#else
+typedef unsigned __int128 uint128_t;
+inline uint64_t fastrange64(uint64_t word, uint64_t p)
+{
+	return (uint128_t(word) * uint128_t(p)) >> 64;
+}
+#define fastrange fastrange64
+#endif
+
+// invokes 'f' for consecutive ranges of the clusters [0, n), in parallel when it is worth it; returns the thread count
+template<typename F>
+static int for_cluster_ranges(const uint64_t n, const F & f)
+{
+#if defined(linux)
+	// at least one (huge) page per thread, else it is not worth it
+	int n_threads = std::max(1, std::min(int(std::thread::hardware_concurrency()), int(n * sizeof(tt_cluster) / (2 * 1024 * 1024))));
+	if (n_threads > 1) {
+		std::vector<std::thread> threads;
+		for(int i=0; i<n_threads; i++)
+			threads.emplace_back(f, n * i / n_threads, n * (i + 1) / n_threads);
+		for(auto & th: threads)
+			th.join();
+		return n_threads;
+	}
+#endif
+	f(uint64_t(0), n);
+	return 1;
+}
+
 tt::tt()
 {
 	allocate();
@@ -31,18 +90,99 @@ tt::tt()
 
 tt::~tt()
 {
-	free(entries);
+	deallocate();
 }
 
 void tt::debug_helper()
 {
 #if !defined(NDEBUG)
 #if !defined(_WIN32) && !defined(ESP32) && !defined(__ANDROID__) && !defined(__APPLE__)
-	VALGRIND_HG_DISABLE_CHECKING(entries, n_entries * sizeof(tt_entry));
+	VALGRIND_HG_DISABLE_CHECKING(clusters, n_clusters * sizeof(tt_cluster));
 #endif
 #endif
 }
 
+#if defined(linux)
+// madvise(MADV_HUGEPAGE) only has effect in "always" and "madvise" mode
+static bool transparent_hugepages_enabled()
+{
+	FILE *fh = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (!fh)
+		return false;
+
+	char buffer[128] { };
+	fgets(buffer, sizeof buffer, fh);
+	fclose(fh);
+
+	return strstr(buffer, "[never]") == nullptr;
+}
+
+// bitmask of the NUMA nodes in this system, 0 if there's only one
+static uint64_t get_numa_nodes()
+{
+	DIR *d = opendir("/sys/devices/system/node");
+	if (!d)
+		return 0;
+
+	uint64_t mask = 0;
+	while(dirent *de = readdir(d)) {
+		int node = -1;
+		if (sscanf(de->d_name, "node%d", &node) == 1 && node >= 0 && node < 64)
+			mask |= uint64_t(1) << node;
+	}
+	closedir(d);
+
+	return __builtin_popcountll(mask) > 1 ? mask : 0;
+}
+
+// spread the pages over all nodes so that no socket has to do all the work
+static void numa_interleave(void *const p, const size_t s)
+{
+	uint64_t mask = get_numa_nodes();
+	if (mask == 0)
+		return;
+
+	constexpr const int MPOL_INTERLEAVE = 3;
+	if (syscall(SYS_mbind, p, s, MPOL_INTERLEAVE, &mask, 65, 0) == -1)
+		printf("# mbind failed: %s\n", strerror(errno));
+}
+
+// which node do the pages of the table live on? (samples 1024 pages)
+static std::string numa_placement(void *const p, const size_t s)
+{
+	if (get_numa_nodes() == 0)
+		return "";
+
+	constexpr const int n_samples = 1024;
+	const size_t        page_size = sysconf(_SC_PAGESIZE);
+	std::vector<void *> pages;
+	for(int i=0; i<n_samples; i++) {
+		size_t offset = s / n_samples * i;
+		pages.push_back(reinterpret_cast<uint8_t *>(p) + offset - offset % page_size);
+	}
+
+	std::vector<int> status(n_samples, -1);
+	if (syscall(SYS_move_pages, 0, n_samples, pages.data(), nullptr, status.data(), 0) == -1)
+		return "";
+
+	int counts[64] { };
+	for(auto node: status) {
+		if (node >= 0 && node < 64)
+			counts[node]++;
+	}
+
+	std::string out;
+	for(int i=0; i<64; i++) {
+		if (counts[i] == 0)
+			continue;
+		char buffer[32];
+		snprintf(buffer, sizeof buffer, "%snode %d: %.1f%%", out.empty() ? "" : ", ", i, counts[i] * 100. / n_samples);
+		out += buffer;
+	}
+	return out;
+}
+#endif
+
 void tt::allocate()
 {
 #if defined(ESP32)
@@ -51,88 +191,302 @@ void tt::allocate()
 		constexpr const size_t max_sp_size = 4 * 1024l * 1024l;
 		psram_size = std::min(psram_size, max_sp_size);
 		printf("Using %zu bytes of PSRAM\n", psram_size);
-		n_entries = psram_size / sizeof(tt_entry);
-		entries = reinterpret_cast<tt_entry *>(heap_caps_malloc(n_entries * sizeof(tt_entry), MALLOC_CAP_SPIRAM));
+		n_clusters = psram_size / sizeof(tt_cluster);
+		clusters = reinterpret_cast<tt_cluster *>(heap_caps_malloc(n_clusters * sizeof(tt_cluster), MALLOC_CAP_SPIRAM));
 	}
 	else {
 		printf("No PSRAM\n");
 		for(;;) {
-			auto n_bytes = n_entries * sizeof(tt_entry);
+			auto n_bytes = n_clusters * sizeof(tt_cluster);
 			printf("Using %zu bytes of RAM\n", size_t(n_bytes));
-			entries = reinterpret_cast<tt_entry *>(malloc(n_bytes));
-			if (entries)
+			clusters = reinterpret_cast<tt_cluster *>(malloc(n_bytes));
+			if (clusters)
 				break;
-			n_entries = std::max(uint64_t(0), n_entries - 1024 / sizeof(tt_entry));
-			if (n_entries == 0)
+			n_clusters = std::max(uint64_t(0), n_clusters - 1024 / sizeof(tt_cluster));
+			if (n_clusters == 0)
 				break;
 		}
 	}
 #else
-	size_t s = n_entries * sizeof(tt_entry);
+	size_t s = n_clusters * sizeof(tt_cluster);
 #if defined(linux)
-	if (posix_memalign(reinterpret_cast<void **>(&entries), 1024 * 1024 * 2, s)) {
-		printf("# posix_memalign failed: %s\n", strerror(errno));
-		entries = reinterpret_cast<tt_entry *>(malloc(s));
+	constexpr const size_t gb = 1024 * 1024 * 1024;
+	if (s >= gb) {
+		// explicit 1 GB pages, only available when reserved by the administrator (hugepagesz=1G hugepages=...)
+		size_t try_size = (s + gb - 1) / gb * gb;
+		void  *p        = mmap(nullptr, try_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), -1, 0);
+		if (p != MAP_FAILED) {
+			clusters  = reinterpret_cast<tt_cluster *>(p);
+			mmap_size = try_size;
+			numa_interleave(clusters, s);
+			printf("# TT uses 1 GB pages\n");
+			return;
+		}
+		printf("# 1 GB pages not available (%s)\n", strerror(errno));
 	}
-	else {
-		if (madvise(entries, s, MADV_HUGEPAGE) == -1)
-			printf("# madvise failed: %s\n", strerror(errno));
+
+	// whether the kernel then backs it with 2 MB pages is up to the kernel (and can change later on)
+	int rc = posix_memalign(reinterpret_cast<void **>(&clusters), 1024 * 1024 * 2, s);
+	if (rc != 0) {
+		printf("# posix_memalign failed: %s\n", strerror(rc));
+		clusters = reinterpret_cast<tt_cluster *>(malloc(s));
+		if (clusters)
+			printf("# TT allocated with malloc, no huge pages requested\n");
+		else
+			printf("# malloc of %zu MB for the TT failed\n", s / (1024 * 1024));
+		return;
 	}
+
+	if (madvise(clusters, s, MADV_HUGEPAGE) == -1)
+		printf("# madvise failed (%s), no huge pages requested for the TT\n", strerror(errno));
+	else if (transparent_hugepages_enabled())
+		printf("# TT: transparent huge pages requested\n");
+	else
+		printf("# TT: transparent huge pages requested, but they are disabled in the kernel\n");
+	// before the first touch (in reset()), which is what places the pages
+	numa_interleave(clusters, s);
 #else
-	entries = reinterpret_cast<tt_entry *>(malloc(s));
+	clusters = reinterpret_cast<tt_cluster *>(malloc(s));
 #endif
 #endif
 }
 
+// when not even a one cluster table can be allocated
+static tt_cluster fallback_cluster;
+
+static void release(tt_cluster *const p, const size_t mmap_size)
+{
+	if (p == &fallback_cluster)
+		return;
+#if defined(linux)
+	if (mmap_size) {
+		munmap(p, mmap_size);
+		return;
+	}
+#endif
+	free(p);
+}
+
+void tt::deallocate()
+{
+	release(clusters, mmap_size);
+	clusters  = nullptr;
+	mmap_size = 0;
+}
+
+// the entries of the old table are moved into the new one; when shrinking, the most valuable entries of a cluster are kept
 void tt::set_size(const uint64_t s)
 {
-	n_entries = std::max(uint64_t(2), s / sizeof(tt_entry));
-	free(entries);
+#if defined(ESP32)
+	// no room for two tables at the same time
+	deallocate();
+#endif
+	tt_cluster *old_clusters   = clusters;
+	uint64_t    old_n_clusters = n_clusters;
+	size_t      old_mmap_size  = mmap_size;
+	uint8_t     old_generation = generation;
+	uint8_t     old_game_age   = game_age;
+
+	clusters   = nullptr;
+	mmap_size  = 0;
+	n_clusters = std::max(uint64_t(1), s / sizeof(tt_cluster));
 	allocate();
+	if (clusters == nullptr && old_clusters) {
+		printf("# No room for the old and the new TT at the same time, the old entries are dropped\n");
+		release(old_clusters, old_mmap_size);
+		old_clusters = nullptr;
+		allocate();
+	}
+	while(clusters == nullptr && n_clusters > 1) {
+		n_clusters /= 2;
+		printf("# Cannot allocate the TT, trying %" PRIu64 " MB\n", get_size() / (1024 * 1024));
+		allocate();
+	}
+	if (clusters == nullptr) {
+		printf("# Cannot allocate the TT, using a single cluster\n");
+		clusters = &fallback_cluster;
+	}
 	reset();
-	printf("# Newly allocated node count: %" PRIu64 "\n", n_entries);
+	printf("# Newly allocated node count: %" PRIu64 "\n", get_n());
+
+	if (old_clusters == nullptr)
+		return;
+
+	generation = old_generation;
+	game_age   = old_game_age;
+
+	uint64_t start_ts = esp_timer_get_time();
+	std::atomic_uint64_t n_migrated { 0 };
+	// fastrange() is monotonic in the hash, so consecutive old clusters map to (mostly) disjoint
+	// new ones; where two threads do meet in a cluster, the key/data xor keeps the slots consistent
+	int n_threads = for_cluster_ranges(old_n_clusters, [this, old_clusters, &n_migrated](const uint64_t start, const uint64_t end) {
+				uint64_t count = 0;
+				for(uint64_t i=start; i<end; i++) {
+					for(auto & slot: old_clusters[i].entries) {
+						uint64_t data = slot.data.load(std::memory_order_relaxed);
+						tt_entry e    = word_to_entry(data);
+						if (e.flags != NOTVALID && is_stale(e) == false)
+							count += migrate_entry(slot.key.load(std::memory_order_relaxed) ^ data, data);
+					}
+				}
+				n_migrated += count;
+			});
+
+	release(old_clusters, old_mmap_size);
+
+	printf("# Migrated %" PRIu64 " entries in %.3f seconds using %d threads\n", n_migrated.load(), (esp_timer_get_time() - start_ts) / 1000000., n_threads);
 }
 
-int tt::get_size() const
+// places an entry from a previous table; returns false when the cluster only holds more valuable entries
+bool tt::migrate_entry(const uint64_t hash, const uint64_t data)
 {
-	return n_entries * sizeof(tt_entry);
+	tt_cluster & c      = clusters[fastrange(hash, n_clusters)];
+	int          target = -1;
+	int          target_value = replacement_value(word_to_entry(data));
+	for(int i=0; i<N_TT_CLUSTER_ENTRIES; i++) {
+		int cur_value = replacement_value(word_to_entry(c.entries[i].data.load(std::memory_order_relaxed)));
+		if (cur_value < target_value) {
+			target       = i;
+			target_value = cur_value;
+		}
+	}
+
+	if (target == -1)
+		return false;
+
+	c.entries[target].data.store(data,        std::memory_order_relaxed);
+	c.entries[target].key .store(hash ^ data, std::memory_order_relaxed);
+
+	return true;
+}
+
+uint64_t tt::get_size() const
+{
+	return n_clusters * sizeof(tt_cluster);
 }
 
 uint64_t tt::get_n() const
 {
-	return n_entries;
+	return n_clusters * N_TT_CLUSTER_ENTRIES;
 }
 
 void tt::reset()
 {
-	memset(entries, 0x00, sizeof(tt_entry) * n_entries);
+#if defined(linux)
+	uint64_t start_ts  = esp_timer_get_time();
+	size_t   n_bytes   = sizeof(tt_cluster) * n_clusters;
+	int      n_threads = for_cluster_ranges(n_clusters, [this](const uint64_t start, const uint64_t end) {
+				memset(static_cast<void *>(&clusters[start]), 0x00, sizeof(tt_cluster) * (end - start));
+			});
+
+	if (n_bytes >= 256 * 1024 * 1024) {
+		printf("# TT of %zu MB cleared in %.3f seconds using %d threads\n", n_bytes / (1024 * 1024), (esp_timer_get_time() - start_ts) / 1000000., n_threads);
+		std::string placement = numa_placement(clusters, n_bytes);
+		if (placement.empty() == false)
+			printf("# TT NUMA placement: %s\n", placement.c_str());
+	}
+#else
+	memset(static_cast<void *>(clusters), 0x00, sizeof(tt_cluster) * n_clusters);
+#endif
+	generation = 0;
+	game_age   = 0;
 }
 
-// see https://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/
-#if defined(ESP32)
-static inline uint32_t fastrange32(uint32_t word, uint32_t p)
+constexpr const int generation_mask = (1 << TT_GENERATION_BITS) - 1;
+constexpr const int old_age         = (generation_mask + 1) / 2;
+
+// The age of an entry is only known modulo the number of generations: a
+// difference of old_age or more may be a wrapped one, so it saturates to
+// old_age ("older than any search of this game"). Only an entry that nothing
+// overwrote for 2 * old_age searches can look young again.
+static inline int get_age(const uint8_t generation, const tt_entry & e)
 {
-	return (uint64_t(word) * uint64_t(p)) >> 32;
+	return std::min((generation - e.generation) & generation_mask, old_age);
 }
-#define fastrange fastrange32
-#else
-typedef unsigned __int128 uint128_t;
-inline uint64_t fastrange64(uint64_t word, uint64_t p)
+
+// invoked for each new search so that entries of previous searches age
+void tt::inc_generation()
 {
-	return (uint128_t(word) * uint128_t(p)) >> 64;
+	generation = (generation + 1) & generation_mask;
+	game_age   = std::min(game_age + 1, old_age - 1);
 }
-#define fastrange fastrange64
-#endif
 
-std::optional<tt_entry> IRAM_ATTR tt::lookup(const uint64_t hash)
+// O(1) replacement for reset(): everything stored before this call is
+// treated as stale (replaceable, only its move is used for ordering)
+void tt::new_game()
 {
-	uint64_t   index = fastrange(hash, n_entries);
-	tt_entry & cur   = entries[index];
+	generation = (generation + 1) & generation_mask;
+	game_age   = 0;
+}
 
-	if (cur.hash == uint16_t(hash))
-		return cur;
+// from a previous game? game_age stays below old_age, so an entry of an age
+// that may have wrapped always is
+bool tt::is_stale(const tt_entry & e) const
+{
+	return get_age(generation, e) > game_age;
+}
 
-	return { };
+// start pulling in the cluster while the caller does other work (e.g. NNUE updates)
+void tt::prefetch(const uint64_t hash) const
+{
+	__builtin_prefetch(&clusters[fastrange(hash, n_clusters)]);
+}
+
+static const uint64_t eval_bits = [] { tt_entry e { }; e.eval = -1; return entry_to_word(e); }();
+
+// returns the index of the slot holding 'hash' (or -1) and the entry stored in it
+static inline int find_slot(const tt_cluster & c, const uint64_t hash, tt_entry *const out, uint32_t *const n_rejected)
+{
+	for(int i=0; i<N_TT_CLUSTER_ENTRIES; i++) {
+		uint64_t data = c.entries[i].data.load(std::memory_order_relaxed);
+		uint64_t key  = c.entries[i].key .load(std::memory_order_relaxed);
+		tt_entry cur  = word_to_entry(data);
+
+		if ((key ^ data) == hash) {
+			if (cur.flags != NOTVALID) {
+				*out = cur;
+				return i;
+			}
+		}
+		else if (((key ^ data ^ hash) & eval_bits) == 0 && cur.flags != NOTVALID && n_rejected) {
+			// the static eval of a position never changes, so when only the other fields
+			// differ, the words came from two different stores of this position: torn write
+			(*n_rejected)++;
+		}
+	}
+
+	return -1;
+}
+
+// overwrites the data word of the slot holding 'hash' but not its key, like the
+// data of a racing store that landed while its key did not
+bool tt::debug_tear(const uint64_t hash, const tt_entry & other)
+{
+	tt_cluster & c = clusters[fastrange(hash, n_clusters)];
+	tt_entry     cur { };
+	int          i = find_slot(c, hash, &cur, nullptr);
+	if (i == -1)
+		return false;
+
+	c.entries[i].data.store(entry_to_word(other), std::memory_order_relaxed);
+
+	return true;
+}
+
+std::optional<tt_entry> IRAM_ATTR tt::lookup(const uint64_t hash, uint32_t *const n_rejected)
+{
+	uint64_t index = fastrange(hash, n_clusters);
+	tt_entry cur { };
+
+	if (find_slot(clusters[index], hash, &cur, n_rejected) == -1)
+		return { };
+
+	if (is_stale(cur)) {
+		cur.flags = NOTVALID;
+		cur.depth = 0;
+	}
+
+	return cur;
 }
 
 uint32_t libchessmove_to_uint(const libchess::Move & m)
@@ -160,45 +514,208 @@ libchess::Move uint_to_libchessmove(const uint32_t v)
 	return libchess::Move{ from, to, type };
 }
 
-void tt::store(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const libchess::Move & m)
+// lower is a better candidate for replacement
+int tt::replacement_value(const tt_entry & e) const
 {
-	tt_entry n { };
-	n.score = int16_t(score);
-	n.depth = uint8_t(d);
-	n.flags = f;
-	n.M     = libchessmove_to_uint(m);
-	n.hash  = uint16_t(hash);
+	if (e.flags == NOTVALID || is_stale(e))  // empty slot or from a previous game
+		return INT_MIN;
 
-	uint64_t index = fastrange(hash, n_entries);
-	entries[index] = n;
+	return e.depth + (e.flags == EXACT ? 2 : 0) - get_age(generation, e) * 8;
 }
 
-void tt::store(const uint64_t hash, const tt_entry_flag f, const int d, const int score)
+void tt::store_entry(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const int eval, const std::optional<uint32_t> & M)
 {
-	uint64_t        index = fastrange(hash, n_entries);
-	tt_entry *const e     = &entries[index];
+	uint64_t     index  = fastrange(hash, n_clusters);
+	tt_cluster & c      = clusters[index];
+	tt_entry     cur { };
+	int          target = find_slot(c, hash, &cur, nullptr);
 
 	tt_entry n { };
-
-	if (e->hash == uint16_t(hash)) {
-		tt_entry & cur = entries[index];
-		n.M = cur.M;
+	n.eval = TT_NO_EVAL;
+
+	if (target != -1) {
+		// don't let a shallow (e.g. qs) result replace a deep one of the same search
+		if (f != EXACT && d + 2 < cur.depth && get_age(generation, cur) == 0)
+			return;
+		n.M    = cur.M;
+		n.eval = cur.eval;
+	}
+	else {
+		// a torn slot decodes to garbage, which is fine: it just gets a random replacement value
+		target = 0;
+		int target_value = replacement_value(word_to_entry(c.entries[0].data.load(std::memory_order_relaxed)));
+		for(int i=1; i<N_TT_CLUSTER_ENTRIES && target_value != INT_MIN; i++) {
+			int cur_value = replacement_value(word_to_entry(c.entries[i].data.load(std::memory_order_relaxed)));
+			if (cur_value < target_value) {
+				target       = i;
+				target_value = cur_value;
+			}
+		}
 	}
 
-	n.score = int16_t(score);
-	n.depth = uint8_t(d);
-	n.flags = f;
-	n.hash  = uint16_t(hash);
+	if (M.has_value())
+		n.M = M.value();
+	if (eval != TT_NO_EVAL)
+		n.eval = int16_t(eval);
+	n.score      = int16_t(score);
+	n.depth      = uint8_t(d);
+	n.flags      = f;
+	n.generation = generation;
+
+	uint64_t data = entry_to_word(n);
+	c.entries[target].data.store(data,        std::memory_order_relaxed);
+	c.entries[target].key .store(hash ^ data, std::memory_order_relaxed);
+}
 
-	entries[index] = n;
+void tt::store(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const int eval, const libchess::Move & m)
+{
+	store_entry(hash, f, d, score, eval, libchessmove_to_uint(m));
+}
+
+void tt::store(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const int eval)
+{
+	store_entry(hash, f, d, score, eval, { });
 }
 
 int tt::get_per_mille_filled() const
 {
-	int count = 0;
-	for(int i=0; i<1000; i++)
-		count += entries[i].hash != 0;
-	return count;
+	uint64_t n     = std::min(n_clusters, uint64_t(1000 / N_TT_CLUSTER_ENTRIES));
+	int      count = 0;
+	for(uint64_t i=0; i<n; i++) {
+		for(int k=0; k<N_TT_CLUSTER_ENTRIES; k++) {
+			tt_entry e = word_to_entry(clusters[i].entries[k].data.load(std::memory_order_relaxed));
+			count += e.flags != NOTVALID && e.generation == generation;
+		}
+	}
+	return count * 1000 / (n * N_TT_CLUSTER_ENTRIES);
+}
+
+#if !defined(ESP32)
+// header of a dumped table; the clusters follow it as-is
+struct tt_file_header
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t cluster_size;
+	uint64_t n_clusters;
+	uint64_t network_hash;
+	uint8_t  generation;
+	uint8_t  game_age;
+	uint8_t  padding[6];
+};
+
+static constexpr const char     tt_file_magic[8] { 'D', 'o', 'g', 'T', 'T', 0, 0, 0 };
+static constexpr const uint32_t tt_file_version  = 2;
+
+bool tt::save(const std::string & file, const uint64_t network_hash) const
+{
+	FILE *fh = fopen(file.c_str(), "wb");
+	if (!fh) {
+		printf("# Cannot create %s: %s\n", file.c_str(), strerror(errno));
+		return false;
+	}
+
+	tt_file_header header { };
+	memcpy(header.magic, tt_file_magic, sizeof header.magic);
+	header.version      = tt_file_version;
+	header.cluster_size = sizeof(tt_cluster);
+	header.n_clusters   = n_clusters;
+	header.network_hash = network_hash;
+	header.generation   = generation;
+	header.game_age     = game_age;
+
+	bool ok = fwrite(&header, sizeof header, 1, fh) == 1 &&
+		fwrite(static_cast<const void *>(clusters), sizeof(tt_cluster), n_clusters, fh) == n_clusters;
+	if (fclose(fh) != 0)
+		ok = false;
+	if (!ok)
+		printf("# Failed writing %s: %s\n", file.c_str(), strerror(errno));
+
+	return ok;
+}
+
+// the table must have been set to the same size as when it was saved
+bool tt::load(const std::string & file, const uint64_t network_hash)
+{
+	FILE *fh = fopen(file.c_str(), "rb");
+	if (!fh) {
+		printf("# Cannot open %s: %s\n", file.c_str(), strerror(errno));
+		return false;
+	}
+
+	tt_file_header header { };
+	const char    *error = nullptr;
+	if (fread(&header, sizeof header, 1, fh) != 1 || memcmp(header.magic, tt_file_magic, sizeof header.magic) != 0)
+		error = "not a transposition table dump";
+	else if (header.version != tt_file_version || header.cluster_size != sizeof(tt_cluster))
+		error = "incompatible version";
+	else if (header.n_clusters != n_clusters)
+		error = "table size differs (set Hash to the size used when saving)";
+	else if (header.network_hash != network_hash)
+		error = "saved with different network weights";
+	else if (fread(static_cast<void *>(clusters), sizeof(tt_cluster), n_clusters, fh) != n_clusters) {
+		error = "file is truncated";
+		reset();
+	}
+	fclose(fh);
+
+	if (error) {
+		printf("# Cannot load %s: %s\n", file.c_str(), error);
+		return false;
+	}
+
+	generation = header.generation & generation_mask;
+	game_age   = header.game_age;
+
+	return true;
+}
+#endif
+
+qs_tt::qs_tt(const size_t size)
+{
+	n_slots = std::max(size_t(1), size / sizeof(qs_tt_slot));
+	slots   = reinterpret_cast<qs_tt_slot *>(malloc(n_slots * sizeof(qs_tt_slot)));
+	reset();
+}
+
+qs_tt::~qs_tt()
+{
+	free(slots);
+}
+
+void qs_tt::reset()
+{
+	memset(static_cast<void *>(slots), 0x00, n_slots * sizeof(qs_tt_slot));
+}
+
+std::optional<tt_entry> qs_tt::lookup(const uint64_t hash) const
+{
+	const qs_tt_slot & s = slots[fastrange(hash, n_slots)];
+	if (s.key != hash || s.e.flags == NOTVALID)
+		return { };
+
+	return s.e;
+}
+
+void qs_tt::store(const uint64_t hash, const tt_entry_flag f, const int score, const int eval, const libchess::Move & m)
+{
+	store(hash, f, score, eval);
+	slots[fastrange(hash, n_slots)].e.M = libchessmove_to_uint(m);
+}
+
+// always replaces: everything in here is depth 0
+void qs_tt::store(const uint64_t hash, const tt_entry_flag f, const int score, const int eval)
+{
+	qs_tt_slot & s = slots[fastrange(hash, n_slots)];
+	if (s.key != hash) {
+		s.key    = hash;
+		s.e      = { };
+		s.e.eval = TT_NO_EVAL;
+	}
+	if (eval != TT_NO_EVAL)
+		s.e.eval = int16_t(eval);
+	s.e.score = int16_t(score);
+	s.e.flags = f;
 }
 
 int eval_to_tt(const int eval, const int ply)
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <optional>
+#include <string>
 
 #include <libchess/Position.h>
 
@@ -10,46 +12,113 @@
 
 typedef enum { NOTVALID = 0, EXACT = 1, LOWERBOUND = 2, UPPERBOUND = 3 } tt_entry_flag;
 
+constexpr const int16_t TT_NO_EVAL = INT16_MIN;
+
+constexpr const int TT_GENERATION_BITS = 5;
+
 typedef struct __PRAGMA_PACKED__
 {
-	uint16_t hash;
+	int16_t  eval;  // static evaluation (nnue) of the position, TT_NO_EVAL when not known
 	int16_t  score;
-	uint8_t  depth  : 8;
-	uint32_t M      : 18;
-	uint8_t  flags  : 2;
-	uint8_t  filler : 4;
+	uint8_t  depth      : 7;  // search depths stop at 127
+	uint32_t M          : 18;
+	uint8_t  flags      : 2;
+	uint8_t  generation : TT_GENERATION_BITS;
 } tt_entry;
 
+// All search threads write to the table without locking. A tt_entry is
+// stored as 'data' and 'key' is the full board hash XOR-ed with it: when
+// two writes race and the words of a slot come from different stores,
+// key ^ data no longer matches and the slot is ignored.
+typedef struct
+{
+	std::atomic_uint64_t key;
+	std::atomic_uint64_t data;
+} tt_slot;
+
+// one cache-line worth of entries, all checked with a single memory access
+constexpr const int N_TT_CLUSTER_ENTRIES = 4;
+
+typedef struct alignas(64)
+{
+	tt_slot entries[N_TT_CLUSTER_ENTRIES];
+} tt_cluster;
+
 class tt
 {
 private:
-	tt_entry *entries { nullptr };
+	tt_cluster *clusters { nullptr };
 #if defined(ESP32)
 #define ESP32_TT_RAM_SIZE 98304
-	uint64_t n_entries { ESP32_TT_RAM_SIZE / sizeof(tt_entry) };
+	uint64_t n_clusters { ESP32_TT_RAM_SIZE / sizeof(tt_cluster) };
 #elif defined(__ANDROID__)
-	uint64_t n_entries { 16 * 1024 * 1024  / sizeof(tt_entry) };
+	uint64_t n_clusters { 16 * 1024 * 1024  / sizeof(tt_cluster) };
 #elif defined(linux) || defined(_WIN32) || defined(__APPLE__)
-	uint64_t n_entries { 16 * 1024 * 1024  / sizeof(tt_entry) };  // as requested, because of OpenBench testing
+	uint64_t n_clusters { 16 * 1024 * 1024  / sizeof(tt_cluster) };  // as requested, because of OpenBench testing
 #endif
+	size_t   mmap_size  { 0 };  // != 0 when allocated with mmap (1 GB pages) instead of malloc
+	uint8_t  generation { 0 };
+	uint8_t  game_age   { 0 };  // number of generations since the start of the current game
+
+	bool is_stale         (const tt_entry & e) const;
+	int  replacement_value(const tt_entry & e) const;
+
 	void allocate();
+	void deallocate();
+	bool migrate_entry(const uint64_t hash, const uint64_t data);
+	void store_entry(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const int eval, const std::optional<uint32_t> & M);
 
 public:
 	tt();
 	~tt();
 
 	void     debug_helper();
+	bool     debug_tear(const uint64_t hash, const tt_entry & other);  // for the tests
 	void     reset();
+	void     inc_generation();
+	void     new_game();
 	void     set_size(const uint64_t s);
-	int      get_size() const;  // in MB
-	uint64_t get_n   () const;
+	uint64_t get_size() const;  // in bytes
+	uint64_t get_n   () const;  // number of entries
 	int      get_per_mille_filled() const;
 
-	std::optional<tt_entry> lookup(const uint64_t board_hash);
-	void store(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const libchess::Move & m);
-	void store(const uint64_t hash, const tt_entry_flag f, const int d, const int score);
+#if !defined(ESP32)
+	bool     save(const std::string & file, const uint64_t network_hash) const;
+	bool     load(const std::string & file, const uint64_t network_hash);
+#endif
+
+	void     prefetch(const uint64_t board_hash) const;
+	std::optional<tt_entry> lookup(const uint64_t board_hash, uint32_t *const n_rejected = nullptr);
+	void store(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const int eval, const libchess::Move & m);
+	void store(const uint64_t hash, const tt_entry_flag f, const int d, const int score, const int eval);
 };
 
+// Small direct-mapped table for the quiescence search, private to one
+// search thread: no atomics needed and it stays in that core's L2.
+class qs_tt
+{
+private:
+	struct qs_tt_slot {
+		uint64_t key;
+		tt_entry e;
+	};
+
+	qs_tt_slot *slots   { nullptr };
+	uint64_t    n_slots { 0       };
+
+public:
+	qs_tt(const size_t size);
+	~qs_tt();
+
+	void reset();
+
+	std::optional<tt_entry> lookup(const uint64_t hash) const;
+	void store(const uint64_t hash, const tt_entry_flag f, const int score, const int eval, const libchess::Move & m);
+	void store(const uint64_t hash, const tt_entry_flag f, const int score, const int eval);
+};
+
+constexpr const size_t qs_tt_default_size = 256 * 1024;
+
 int eval_to_tt  (const int eval, const int ply);
 int eval_from_tt(const int eval, const int ply);
 uint32_t       libchessmove_to_uint(const libchess::Move & m);
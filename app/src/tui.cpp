@@ -3,6 +3,7 @@
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
+#include <memory>
 #include <ctype.h>
 #include <signal.h>
 #if defined(ESP32)
@@ -518,28 +519,28 @@ int get_complexity(const libchess::Position & pos, const libchess::Color & c)
 
 int get_score(const libchess::Position & pos, const libchess::Move & m)
 {
-	libchess::Position work(pos );
-	Eval               e   (work);
+	libchess::Position    work(pos );
+	std::unique_ptr<Eval> e   (Eval::create(work));
 
-	make_move(&e, work, m);
+	make_move(e.get(), work, m);
 
-	return -nnue_evaluate(&e, work);
+	return -nnue_evaluate(e.get(), work);
 }
 
 int get_score(const libchess::Position & pos, const libchess::Move & m, const libchess::Color & c)
 {
-	libchess::Position work(pos );
-	Eval               e   (work);
+	libchess::Position    work(pos );
+	std::unique_ptr<Eval> e   (Eval::create(work));
 
-	make_move(&e, work, m);
+	make_move(e.get(), work, m);
 
-	return nnue_evaluate(&e, c);
+	return nnue_evaluate(e.get(), c);
 }
 
 int get_score(const libchess::Position & pos, const libchess::Color & c)
 {
-	Eval e(pos);
-	return nnue_evaluate(&e, c);
+	std::unique_ptr<Eval> e(Eval::create(pos));
+	return nnue_evaluate(e.get(), c);
 }
 
 std::string perc(const unsigned total, const unsigned part)
@@ -581,11 +582,12 @@ void show_stats(const libchess::Position & pos, const chess_stats & cs, const bo
 	my_printf("Standing pats : %u\n", cs.data.n_standing_pat);
 	my_printf("Endings       : %u (check), %u (stale), %u (draw)\n", cs.data.n_checkmate, cs.data.n_stalemate, cs.data.n_draws);
 	my_printf("Asp.win resize: %u\n", cs.data.asp_win_resizes);
-	my_printf("TT queries    : %u (total), %s (hits), %u (store), %s (invalid)\n",
+	my_printf("TT queries    : %u (total), %s (hits), %u (store), %s (invalid), %u (rejected)\n",
 			cs.data.tt_query,
 			perc(cs.data.tt_query, cs.data.tt_hit).c_str(),
 			cs.data.tt_store,
-			perc(cs.data.tt_query, cs.data.tt_invalid).c_str());
+			perc(cs.data.tt_query, cs.data.tt_invalid).c_str(),
+			cs.data.tt_rejected);
 	my_printf("QS TT queries : %u (total), %s (hits), %u (store)\n",
 			cs.data.qtt_query,
 			perc(cs.data.qtt_query, cs.data.qtt_hit).c_str(),
@@ -596,8 +598,19 @@ void show_stats(const libchess::Position & pos, const chess_stats & cs, const bo
 	my_printf("Null moves    : %s (hits)\n", perc(cs.data.n_null_move, cs.data.n_null_move_hit).c_str());
 	my_printf("LMR           : %u (total), %s (hits)\n",
 			cs.data.n_lmr, perc(cs.data.n_lmr, cs.data.n_lmr_hit).c_str());
-	my_printf("Static eval   : %u (total), %s (hits)\n",
-			cs.data.n_static_eval, perc(cs.data.n_static_eval, cs.data.n_static_eval_hit).c_str());
+	my_printf("Static eval   : %u (total), %s (hits), %u (from TT)\n",
+			cs.data.n_static_eval, perc(cs.data.n_static_eval, cs.data.n_static_eval_hit).c_str(),
+			cs.data.tt_eval_hit);
+	if (cs.data.nnue_updates)
+		my_printf("NNUE updates  : %" PRIu64 " (total), %.2f%% (skipped, lazy)\n",
+				cs.data.nnue_updates, cs.data.nnue_updates_skipped * 100. / cs.data.nnue_updates);
+	if (cs.data.eval_cache_query)
+		my_printf("Eval cache    : %" PRIu64 " (total), %.2f%% (hits), ~%.0f ns saved per hit\n",
+				cs.data.eval_cache_query, cs.data.eval_cache_hit * 100. / cs.data.eval_cache_query,
+				cs.data.eval_timed ? cs.data.eval_timed_ns / double(cs.data.eval_timed) : 0.);
+	if (cs.data.quiet_gen)
+		my_printf("Quiet gen.    : %" PRIu64 " (total), %.2f%% (skipped)\n",
+				cs.data.quiet_gen, cs.data.quiet_gen_skipped * 100. / cs.data.quiet_gen);
 	if (cs.data.nmc_nodes)
 		my_printf("Avg. move c/o : %.2f\n", cs.data.n_moves_cutoff / double(cs.data.nmc_nodes));
 	if (cs.data.nmc_qnodes)
@@ -912,6 +925,8 @@ static void help()
 	my_printf("sysinfo  system info\n");
 #else
 	my_printf("syzygy   probe the syzygy ETB\n");
+	my_printf("savett   write the transposition table to a file\n");
+	my_printf("loadtt   read a transposition table from a file\n");
 #endif
 	my_printf("submit   send current PGN to server, result is shown\n");
 	my_printf("book     check for a move in the book or disable/enable\n");
@@ -1231,7 +1246,7 @@ void tui()
 	auto reset_state = [&]()
 	{
 		memset(sp.at(0)->history, 0x00, history_malloc_size);
-		tti.reset();
+		tti.new_game();
 		moves_played.clear();
 		scores.clear();
 		start_fen           = libchess::constants::STARTPOS_FEN;
@@ -1651,6 +1666,14 @@ void tui()
 #if !defined(ESP32)
 			else if (parts[0] == "syzygy")
 				do_syzygy(sp.at(0)->pos);
+			else if (parts[0] == "savett" && parts.size() == 2) {
+				if (tti.save(parts[1], get_network_hash()))
+					my_printf("Transposition table saved\n");
+			}
+			else if (parts[0] == "loadtt" && parts.size() == 2) {
+				if (tti.load(parts[1], get_network_hash()))
+					my_printf("Transposition table loaded\n");
+			}
 #endif
 			else if (parts[0] == "trace") {
 				if (parts.size() == 2) {
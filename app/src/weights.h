@@ -1,7 +1,7 @@
 #pragma once
 
 #if defined(ESP32)
-constexpr int HIDDEN_SIZE = 128;
+constexpr int HIDDEN_SIZE = 128;  // of the embedded network
 #else
-constexpr int HIDDEN_SIZE = 256;
+constexpr int HIDDEN_SIZE = 256;  // of the embedded network
 #endif